@@ -18,6 +18,11 @@ s32 BaseFrame::LoadConfig(const std::string& options, FrameConf& conf)
     conf.space_conf_.fixed_ = 0x00006AAAAAAAAAAAULL;
     conf.space_conf_.fixed_ = 0x0000700000000000ULL;
 #endif // WIN32
+    conf.boot_conf_.prefault_ = 0;
+    conf.boot_conf_.prefault_threads_ = 4;
+    conf.boot_conf_.numa_node_ = -1;
+    conf.boot_conf_.resume_threads_ = 4;
+    conf.boot_conf_.slab_threshold_ = zmalloc::SLAB_MAX_REQUEST;
 
     PoolHelper helper;
     helper.Attach(conf.pool_conf_, true);
@@ -31,18 +36,31 @@ s32 BaseFrame::LoadConfig(const std::string& options, FrameConf& conf)
     conf.space_conf_.subs_[ShmSpace::kMainFrame].size_ = SPACE_ALIGN(sizeof(BaseFrame));
     conf.space_conf_.subs_[ShmSpace::kPool].size_ = kPoolSpaceHeadSize + helper.TotalSpaceSize();
     conf.space_conf_.subs_[ShmSpace::kBuddy].size_ = SPACE_ALIGN(zbuddy::zbuddy_size(kHeapSpaceOrder));
-    conf.space_conf_.subs_[ShmSpace::kMalloc].size_ = SPACE_ALIGN(zmalloc::zmalloc_size());
+    conf.space_conf_.subs_[ShmSpace::kMalloc].size_ = SPACE_ALIGN(sizeof(zmalloc_arenas));
     conf.space_conf_.subs_[ShmSpace::kHeap].size_ = SPACE_ALIGN(zbuddy_shift_size(kHeapSpaceOrder + kPageOrder));
+    conf.space_conf_.subs_[ShmSpace::kTimer].size_ = SPACE_ALIGN(kTimerSpaceSize);
+    conf.space_conf_.subs_[ShmSpace::kCommand].size_ = SPACE_ALIGN(kCommandSpaceSize);
+    conf.space_conf_.subs_[ShmSpace::kThreadCache].size_ = SPACE_ALIGN(sizeof(ztcache));
 
-    conf.space_conf_.whole_.size_ = SPACE_ALIGN(sizeof(conf.space_conf_));
+    LayoutSpace(conf.space_conf_);
+
+    return 0;
+}
+
+void BaseFrame::LayoutSpace(zshm_space& space_conf)
+{
+    space_conf.whole_.size_ = SPACE_ALIGN(sizeof(space_conf));
     for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
     {
-        conf.space_conf_.subs_[i].offset_ = conf.space_conf_.whole_.size_;
-        conf.space_conf_.whole_.size_ += conf.space_conf_.subs_[i].size_;
+        if (i == ShmSpace::kPool)
+        {
+            continue;
+        }
+        space_conf.subs_[i].offset_ = space_conf.whole_.size_;
+        space_conf.whole_.size_ += space_conf.subs_[i].size_;
     }
-
-
-    return 0;
+    space_conf.subs_[ShmSpace::kPool].offset_ = space_conf.whole_.size_;
+    space_conf.whole_.size_ += space_conf.subs_[ShmSpace::kPool].size_;
 }
 
 
@@ -53,11 +71,14 @@ s32 BaseFrame::Init()
 
 s32 BaseFrame::Start()
 {
+    stages_.reset();
     return 0;
 }
 
 s32 BaseFrame::Resume()
 {
+    //stage hooks are code ptrs of the old process  
+    stages_.reset();
     return 0;
 }
 
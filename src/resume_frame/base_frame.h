@@ -10,12 +10,16 @@
 #define BASE_FRAME_H_
 #include "frame_option.h"
 #include "pool_helper.h"
+#include "frame_stages.h"
 
 
 class BaseFrame
 {
 public:
+    virtual ~BaseFrame() {}
     static s32 LoadConfig(const std::string& options, FrameConf& conf);
+    //fill offset and whole size after all sub size set. pool space is the tail, so grow pools not move other sub spaces.   
+    static void LayoutSpace(zshm_space& space_conf);
     virtual s32 Init();
     virtual s32 Resume();
 
@@ -24,6 +28,10 @@ public:
 
     virtual s32 Tick(s64 now_ms) = 0;
 
+public:
+    //stages are added again in Start/Resume of the derived frame, Tick runs them by stages_.run(now_ms).   
+    FrameStages stages_;
+
 private:
 
 };
@@ -11,6 +11,11 @@
 
 #include "frame_def.h"
 #include "base_frame.h"
+#include "frame_workers.h"
+#include "frame_timer.h"
+#include "frame_commands.h"
+#include "frame_io.h"
+#include "frame_observer.h"
 #include "frame_option.h"
 
 
@@ -48,12 +53,70 @@ private:
     template<class T>
     static inline void DestroyObject(T* addr){addr->~T();}
 
+    //init all pools in pool sub space by conf.   
+    static inline s32 BuildPools(const PoolSpace& pool_conf);
+    //only pool space grows: rebuild frame with new layout and relocate pool chunks by chunk id.  
+    static inline s32 MigrateShm(FrameConf& conf, zshm_space*& shm_space);
+    //resume on a copy of the live frame in the other key, the live frame is never written.  
+    static inline s32 ShadowResumeShm(FrameConf& conf);
+    //fix global instance, vptr and call Frame::Resume after the frame attached.  
+    static inline s32 ResumeSpace(FrameConf& conf);
+    //fix object vptr of all pools, a large pool is split to batches in threads.   
+    static inline s32 ResumePools(PoolSpace* space, s32 threads);
+    static constexpr s32 kResumeBatchChunks = 64 * 1024;
+    //bytes need copy when clone a sub space. heap pages after the right bound of buddy are never used.  
+    static inline u64 CopySize(const zshm_space& head, const char* base, u32 sub_id)
+    {
+        u64 size = head.subs_[sub_id].size_;
+        if (sub_id == ShmSpace::kHeap)
+        {
+            const zbuddy* buddy = (const zbuddy*)(base + head.subs_[ShmSpace::kBuddy].offset_);
+            size = std::min(size, (u64)buddy->get_right_bound_used() << kPageOrder);
+        }
+        return size;
+    }
+
+    //process local state of the snapshot chain: base file + deltas.   
+    struct SnapshotState
+    {
+        std::string path_;
+        u64 base_hash_ = 0;
+        u64 seq_ = 0;
+        zshm_dirty_tracker tracker_;
+    };
+    static inline SnapshotState& Snapshot() { static SnapshotState state; return state; }
+
+    //which page size each sub space real received (huge page may fallback to normal page)  
+    static inline void ReportSpace(const char* desc)
+    {
+        LogInfo() << desc << " space:" << (void*)g_shm_space << ", whole size:" << ShmSpace().whole_.size_
+            << ", use huge page:" << (u32)ShmSpace().use_huge_page_ << ", page size:" << ShmSpace().page_size_;
+        for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+        {
+            const zshm_sub& sub = ShmSpace().subs_[i];
+            if (sub.size_ == 0)
+            {
+                continue;
+            }
+            LogInfo() << desc << " sub space:" << i << ", offset:" << sub.offset_ << ", size:" << sub.size_ 
+                << ", page size:" << zshm_boot::sub_page_size(ShmSpace(), i);
+        }
+    }
+
 public:
     static inline s32 BuildShm(const std::string& options);
     static inline s32 ResumeShm(const std::string& options);
     static inline s32 ExitShm(const std::string& options); //˳ 
     static inline s32 DelShm(const std::string& options);
+    static inline s32 SnapshotShm(const std::string& path); //call between ticks  
+    static inline s32 SnapshotDeltaShm(const std::string& path); //only blocks changed since last snapshot of path  
+    static inline s32 CompactSnapshot(const std::string& path); //merge deltas into the base file  
+    static inline s32 RestoreShm(const std::string& options, const std::string& path);
     static inline s32 DoTick(s64 now_ms);
+
+    //observer process: map the live frame read only, read pools by PoolView in FrameEpoch::Read.  
+    static inline s32 AttachReadOnly(const std::string& options);
+    static inline s32 DetachReadOnly();
 };
 
 
@@ -82,6 +145,44 @@ s32 FrameBoot<Frame>::BuildShm(const std::string& options)
         }
         g_shm_space = shm_space;
         ShmSpace().fixed_ = (u64)shm_space;
+        ReportSpace("build");
+    }
+
+    if (conf.boot_conf_.prefault_ || conf.boot_conf_.numa_node_ >= 0)
+    {
+        zclock total_clock;
+        total_clock.start();
+        for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+        {
+            if (ShmSpace().subs_[i].size_ == 0)
+            {
+                continue;
+            }
+            zclock sub_clock;
+            sub_clock.start();
+            if (conf.boot_conf_.numa_node_ >= 0)
+            {
+                ret = zshm_boot::bind_sub_numa(ShmSpace(), i, conf.boot_conf_.numa_node_);
+                if (ret != 0)
+                {
+                    LogWarn() << "bind sub space:" << i << " to numa node:" << conf.boot_conf_.numa_node_ << " failed. ret:" << zshm_errno::str(ret);
+                }
+            }
+            if (conf.boot_conf_.prefault_)
+            {
+                ret = zshm_boot::prefault_sub(ShmSpace(), i, conf.boot_conf_.prefault_threads_);
+                if (ret != 0)
+                {
+                    LogError() << "prefault sub space:" << i << " error. ret:" << zshm_errno::str(ret);
+                    return ret;
+                }
+            }
+            sub_clock.save();
+            LogInfo() << "prefault sub space:" << i << ", size:" << ShmSpace().subs_[i].size_ << ", numa node:" << conf.boot_conf_.numa_node_
+                << ", used:" << sub_clock.duration_ns() / 1000 << "us";
+        }
+        total_clock.save();
+        LogInfo() << "prefault all sub space used:" << total_clock.duration_ns() / 1000 << "us";
     }
 
     if (true)
@@ -99,66 +200,431 @@ s32 FrameBoot<Frame>::BuildShm(const std::string& options)
 
     if (true)
     {
-        zmalloc* malloc_ptr = SubSpace<zmalloc, ShmSpace::kMalloc>();
-        memset(malloc_ptr, 0, zmalloc::zmalloc_size());
+        zmalloc_arenas* arenas_ptr = SubSpace<zmalloc_arenas, ShmSpace::kMalloc>();
+        arenas_ptr->init(&AllocLarge, &FreeLarge);
+        arenas_ptr->set_slab_threshold(conf.boot_conf_.slab_threshold_);
+        arenas_ptr->set_global(arenas_ptr);
+        zmalloc* malloc_ptr = &arenas_ptr->arena(0);
         malloc_ptr->set_global(malloc_ptr);
-        malloc_ptr->set_block_callback(&AllocLarge, &FreeLarge);
-        malloc_ptr->check_panic();
+        arenas_ptr->check_panic();
+
+        if (ShmSpace().subs_[ShmSpace::kThreadCache].size_ < sizeof(ztcache))
+        {
+            LogError() << "thread cache sub size:" << ShmSpace().subs_[ShmSpace::kThreadCache].size_ << " less than:" << sizeof(ztcache);
+            return zshm_errno::E_INVALID_PARAM;
+        }
+        ztcache* tcache_ptr = SubSpace<ztcache, ShmSpace::kThreadCache>();
+        tcache_ptr->init(arenas_ptr);
+        tcache_ptr->set_global(tcache_ptr);
     }
 
 
 
 
+    ret = BuildPools(conf.pool_conf_);
+    if (ret != 0)
+    {
+        LogError() << "";
+        return ret;
+    }
+
+    ret = FrameTimer::Build(zclock::now_ms());
+    if (ret != 0)
+    {
+        LogError() << "build timer wheel error. ret:" << ret;
+        return ret;
+    }
+
+    ret = FrameCommands::Build();
+    if (ret != 0)
+    {
+        LogError() << "build command ring error. ret:" << ret;
+        return ret;
+    }
+
     if (true)
     {
-        PoolSpace* space = SubSpace<PoolSpace, ShmSpace::kPool>();
-        memcpy(space, &conf.pool_conf_, kPoolSpaceHeadSize);
-        space->symbols_.attach(space->names_, kLimitObjectNameBuffSize, kLimitObjectNameBuffSize); //rebuild symbols   
-        u64 offset = kPoolSpaceHeadSize;
+        BuildObject<Frame>(SubSpace<Frame, ShmSpace::kMainFrame>());
+    }
+
+
+    ret = SubSpace<Frame, ShmSpace::kMainFrame>()->Start();
+    if (ret != 0)
+    {
+        LogError() << "";
+        return ret;
+    }
+
+    FrameWorkers::Instance().Start(conf.boot_conf_.tick_threads_);
+    FrameIO::Instance().Start(conf.boot_conf_.io_uring_ != 0, conf.boot_conf_.io_threads_);
+    return 0;
+}
+
+
 
-        for (s32 i = 0; i <= space->max_used_id_; i++)
+template <class Frame>
+s32 FrameBoot<Frame>::BuildPools(const PoolSpace& pool_conf)
+{
+    PoolSpace* space = SubSpace<PoolSpace, ShmSpace::kPool>();
+    memcpy(space, &pool_conf, kPoolSpaceHeadSize);
+    space->symbols_.attach(space->names_, kLimitObjectNameBuffSize, kLimitObjectNameBuffSize); //rebuild symbols   
+    u64 offset = kPoolSpaceHeadSize;
+
+    for (s32 i = 0; i <= space->max_used_id_; i++)
+    {
+        if (space->conf_[i].obj_count_ == 0)
         {
-            if (space->conf_[i].obj_count_ == 0)
-            {
-                continue;
-            }
-            //rebuild pool in real SubSpace  addr  
-            zmem_pool& pool = space->pools_[i];
-            PoolConf& conf = space->conf_[i];
-            s32 ret = pool.init(conf.obj_size_, conf.name_id_, conf.vptr_, conf.obj_count_, (char*)space + offset, conf.space_size_);
-            if (ret != 0)
-            {
-                LogError() << "";
-                return ret;
-            }
-            offset += conf.space_size_;
-            LogDebug() << "build pool " << space->symbols_.at(pool.name_id_) << ":" << pool;
+            continue;
+        }
+        //rebuild pool in real SubSpace  addr  
+        zmem_pool& pool = space->pools_[i];
+        PoolConf& conf = space->conf_[i];
+        s32 ret = pool.init(conf.obj_size_, conf.name_id_, conf.vptr_, conf.obj_count_, (char*)space + offset, conf.space_size_, conf.with_bitmap_ != 0);
+        if (ret != 0)
+        {
+            LogError() << "";
+            return ret;
+        }
+        s64 chunks_size = zmem_pool::calculate_space_size(conf.obj_size_, conf.obj_count_, conf.with_bitmap_ != 0);
+        ret = space->soas_[i].init(conf.obj_count_, conf.column_size_, conf.column_count_, (char*)space + offset + chunks_size, conf.space_size_ - chunks_size);
+        if (ret != 0)
+        {
+            LogError() << "build soa columns of pool:" << i << " error. ret:" << ret;
+            return ret;
         }
+        offset += conf.space_size_;
+        LogDebug() << "build pool " << space->symbols_.at(pool.name_id_) << ":" << pool;
+    }
 
-        if (offset > ShmSpace().subs_[kPool].size_)
+    if (offset > ShmSpace().subs_[kPool].size_)
+    {
+        LogError();
+        return -2;
+    }
+    return 0;
+}
+
+
+template <class Frame>
+s32 FrameBoot<Frame>::MigrateShm(FrameConf& conf, zshm_space*& shm_space)
+{
+    zclock clock;
+    clock.start();
+    zshm_space old_head = *shm_space;
+    for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+    {
+        if (i == ShmSpace::kPool)
+        {
+            continue;
+        }
+        if (memcmp(&old_head.subs_[i], &conf.space_conf_.subs_[i], sizeof(zshm_sub)) != 0)
         {
-            LogError();
-            return -2;
+            LogError() << "migrate error: sub space:" << i << " changed, only pool space can grow.";
+            return zshm_errno::E_SHM_VERSION_MISMATCH;
         }
     }
 
-    if (true)
+    PoolHelper helper;
+    s32 ret = helper.Attach(conf.pool_conf_, false);
+    if (ret != 0)
     {
-        BuildObject<Frame>(SubSpace<Frame, ShmSpace::kMainFrame>());
+        LogError() << "";
+        return ret;
+    }
+    ret = helper.Compatible((const PoolSpace*)((char*)shm_space + old_head.subs_[ShmSpace::kPool].offset_));
+    if (ret != 0)
+    {
+        LogError() << "migrate error: pool conf not compatible. ret:" << ret;
+        return zshm_errno::E_SHM_VERSION_MISMATCH;
     }
 
+    /*
+    * shm can not grow and the key can not be renamed: map the old frame at a second address, release its key
+    * and build the new frame at the same key and address. chunks are relocated from the second mapping (no heap copy).
+    * the old segment lives until the switch is done. any error restores it to the key with the old layout.
+    * a crash between the key release and the end of migrate loses the frame (the released segment dies with the process).
+    */
+    std::array<u64, ZSHM_MAX_SPACES> copy_size;
+    for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+    {
+        copy_size[i] = CopySize(old_head, (const char*)shm_space, i);
+    }
+    zshm_loader old_loader(old_head.use_heap_, old_head.shm_key_, old_head.whole_.size_);
+    ret = old_loader.attach(0);
+    if (ret != 0)
+    {
+        LogError() << "migrate error: map old frame at a second address error. ret:" << zshm_errno::str(ret);
+        return ret;
+    }
+    const char* old_base = (const char*)old_loader.shm_mnt_addr();
+    shm_space = nullptr;
+    g_shm_space = nullptr;
+    ret = zshm_boot::destroy_frame(old_head);
+    if (ret != 0)
+    {
+        LogError() << "migrate error: release old frame key error. ret:" << zshm_errno::str(ret);
+        old_loader.detach();
+        return ret;
+    }
 
-    ret = SubSpace<Frame, ShmSpace::kMainFrame>()->Start();
+    auto restore_old = [&old_head, &old_loader, &copy_size, old_base](s32 err)
+    {
+        if (g_shm_space != nullptr)
+        {
+            zshm_boot::destroy_frame(*g_shm_space);
+            g_shm_space = nullptr;
+        }
+        zshm_space* restored = nullptr;
+        s32 ret = zshm_boot::build_frame(old_head, restored);
+        if (ret != 0 || restored == nullptr)
+        {
+            LogError() << "migrate error: restore old frame error, old frame is lost. ret:" << zshm_errno::str(ret);
+            old_loader.detach();
+            return err;
+        }
+        memcpy((char*)restored + sizeof(zshm_space), old_base + sizeof(zshm_space), old_head.subs_[0].offset_ - sizeof(zshm_space));
+        for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+        {
+            memcpy((char*)restored + old_head.subs_[i].offset_, old_base + old_head.subs_[i].offset_, copy_size[i]);
+        }
+        u64 page_size = restored->page_size_;
+        memcpy(restored, old_base, sizeof(zshm_space));
+        restored->page_size_ = page_size;
+        zshm_boot::detach_frame(*restored);
+        old_loader.detach();
+        LogWarn() << "migrate failed, old frame is restored with old layout.";
+        return err;
+    };
+
+    ret = zshm_boot::build_frame(conf.space_conf_, shm_space);
+    if (ret != 0 || shm_space == nullptr)
+    {
+        LogError() << "migrate error: build new frame error. ret:" << zshm_errno::str(ret);
+        shm_space = nullptr;
+        return restore_old(ret != 0 ? ret : -1);
+    }
+    g_shm_space = shm_space;
+
+    //other sub spaces not moved  
+    for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+    {
+        if (i != ShmSpace::kPool)
+        {
+            memcpy((char*)shm_space + old_head.subs_[i].offset_, old_base + old_head.subs_[i].offset_, copy_size[i]);
+        }
+    }
+
+    ret = BuildPools(conf.pool_conf_);
     if (ret != 0)
     {
         LogError() << "";
+        shm_space = nullptr;
+        return restore_old(ret);
+    }
+
+    PoolSpace* space = SubSpace<PoolSpace, ShmSpace::kPool>();
+    const PoolSpace* old_space = (const PoolSpace*)(old_base + old_head.subs_[ShmSpace::kPool].offset_);
+    space->layout_version_ = old_space->layout_version_ + 1;
+    for (s32 i = 0; i <= old_space->max_used_id_; i++)
+    {
+        const zmem_pool& old_pool = old_space->pools_[i];
+        if (old_pool.obj_count_ == 0)
+        {
+            continue;
+        }
+        const char* old_chunks = old_base + ((u64)old_pool.space_ - old_head.fixed_);
+        ret = space->pools_[i].relocate(old_pool, old_chunks);
+        if (ret != 0)
+        {
+            LogError() << "migrate error: relocate pool:" << i << " error. ret:" << ret;
+            shm_space = nullptr;
+            return restore_old(ret);
+        }
+        const zsoa_pool& old_soa = old_space->soas_[i];
+        const char* old_columns = old_soa.has_columns() ? old_base + ((u64)old_soa.space_ - old_head.fixed_) : nullptr;
+        ret = space->soas_[i].relocate(old_soa, old_columns);
+        if (ret != 0)
+        {
+            LogError() << "migrate error: relocate soa columns of pool:" << i << " error. ret:" << ret;
+            shm_space = nullptr;
+            return restore_old(ret);
+        }
+        LogDebug() << "migrate pool " << space->symbols_.at(space->pools_[i].name_id_) << ":" << space->pools_[i];
+    }
+    //switch done: the old segment is freed by the kernel after the last detach.
+    old_loader.detach();
+    clock.save();
+    LogInfo() << "migrate to layout version:" << space->layout_version_ << ", whole size:" << old_head.whole_.size_
+        << " -> " << ShmSpace().whole_.size_ << ", used:" << clock.duration_ns() / 1000 << "us";
+    return 0;
+}
+
+
+template <class Frame>
+s32 FrameBoot<Frame>::ShadowResumeShm(FrameConf& conf)
+{
+    if (conf.space_conf_.use_heap_ || conf.boot_conf_.shadow_key_ == 0 || conf.boot_conf_.shadow_key_ == conf.space_conf_.shm_key_)
+    {
+        LogError() << "shadow resume need shm and a different shadow key.";
+        return zshm_errno::E_INVALID_PARAM;
+    }
+
+    //the live frame maybe in either key.  
+    zshm_loader loaders[2];
+    u64 keys[2] = { conf.space_conf_.shm_key_, conf.boot_conf_.shadow_key_ };
+    s32 live = -1;
+    for (s32 i = 0; i < 2; i++)
+    {
+        loaders[i].init(false, keys[i], 0);
+        if (loaders[i].check() != 0)
+        {
+            continue;
+        }
+        s32 ret = loaders[i].attach(0);
+        if (ret != 0)
+        {
+            LogError() << "attach key:" << keys[i] << " error. ret:" << zshm_errno::str(ret);
+            return ret;
+        }
+        if (live < 0)
+        {
+            live = i;
+            continue;
+        }
+        //both exist: a switch was broken. the older one or the not ready shadow is stale.   
+        u64 live_seq = ((const zshm_space*)loaders[live].shm_mnt_addr())->frame_seq_;
+        u64 seq = ((const zshm_space*)loaders[i].shm_mnt_addr())->frame_seq_;
+        s32 stale = seq > live_seq ? live : i;
+        live = seq > live_seq ? i : live;
+        LogWarn() << "found stale frame key:" << keys[stale] << ", destroy it.";
+        loaders[stale].destroy();
+    }
+    if (live < 0)
+    {
+        LogError() << "no live frame in key:" << keys[0] << " or key:" << keys[1];
+        return zshm_errno::E_NO_SHM_MAPPING;
+    }
+
+    const zshm_space* live_space = (const zshm_space*)loaders[live].shm_mnt_addr();
+    s32 ret = zshm_boot::check_frame(conf.space_conf_, *live_space);
+    if (ret != 0)
+    {
+        LogError() << "live frame key:" << keys[live] << " version error. ret:" << zshm_errno::str(ret);
+        loaders[live].detach();
         return ret;
     }
 
+    //clone live frame to shadow key at fixed address.  
+    zclock clock;
+    clock.start();
+    zshm_space params = conf.space_conf_;
+    params.shm_key_ = keys[1 - live];
+    zshm_space* shadow = nullptr;
+    ret = zshm_boot::build_frame(params, shadow);
+    if (ret != 0 || shadow == nullptr)
+    {
+        LogError() << "build shadow frame key:" << params.shm_key_ << " error. ret:" << zshm_errno::str(ret);
+        loaders[live].detach();
+        return ret != 0 ? ret : -1;
+    }
+    shadow->frame_seq_ = 0;
+    for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+    {
+        u64 offset = live_space->subs_[i].offset_;
+        memcpy((char*)shadow + offset, (const char*)live_space + offset, CopySize(*live_space, (const char*)live_space, i));
+    }
+    u64 live_seq = live_space->frame_seq_;
+    loaders[live].detach();
+    clock.save();
+    LogInfo() << "clone frame key:" << keys[live] << " to shadow key:" << params.shm_key_ << ", used:" << clock.duration_ns() / 1000 << "us";
+
+    g_shm_space = shadow;
+    ReportSpace("shadow resume");
+    ret = ResumeSpace(conf);
+    if (ret != 0)
+    {
+        LogError() << "resume on shadow frame error, live frame key:" << keys[live] << " is not changed. ret:" << ret;
+        zshm_boot::destroy_frame(*shadow);
+        g_shm_space = nullptr;
+        return ret;
+    }
+
+    //switch: shadow become live, old live will be free after the old process detached.  
+    shadow->frame_seq_ = live_seq + 1;
+    ret = zshm_loader::external_destroy(keys[live], false, nullptr, 0);
+    if (ret != 0)
+    {
+        LogWarn() << "remove old frame key:" << keys[live] << " error. ret:" << zshm_errno::str(ret);
+    }
+    LogInfo() << "switch to shadow frame key:" << params.shm_key_ << ", frame seq:" << shadow->frame_seq_;
     return 0;
 }
 
 
+template <class Frame>
+s32 FrameBoot<Frame>::ResumePools(PoolSpace* space, s32 threads)
+{
+    for (s32 i = 0; i <= space->max_used_id_; i++)
+    {
+        zmem_pool& pool = space->pools_[i];
+        if (pool.obj_count_ == 0)
+        {
+            continue;
+        }
+        zclock clock;
+        clock.start();
+        u64 vptr = space->conf_[i].vptr_;
+        s32 fixed_count = 0;
+        s32 workers = 1;
+        pool.vptr_fixed_ = 0;
+        if (pool.obj_vptr_ != 0 && vptr != 0)
+        {
+            pool.obj_vptr_ = vptr;
+            s32 batches = (pool.exploit_ + kResumeBatchChunks - 1) / kResumeBatchChunks;
+            workers = std::max(1, std::min(threads, batches));
+            if (workers == 1)
+            {
+                fixed_count = pool.resume_range(0, pool.exploit_);
+            }
+            else
+            {
+                std::atomic<s32> next_batch(0);
+                std::atomic<s32> total_fixed(0);
+                std::vector<std::thread> worker_threads;
+                for (s32 w = 0; w < workers; w++)
+                {
+                    worker_threads.emplace_back([&pool, &next_batch, &total_fixed, batches]()
+                        {
+                            s32 fixed = 0;
+                            s32 batch = 0;
+                            while ((batch = next_batch++) < batches)
+                            {
+                                s32 begin_id = batch * kResumeBatchChunks;
+                                fixed += pool.resume_range(begin_id, std::min(pool.exploit_, begin_id + kResumeBatchChunks));
+                            }
+                            total_fixed += fixed;
+                        });
+                }
+                for (auto& t : worker_threads)
+                {
+                    t.join();
+                }
+                fixed_count = total_fixed;
+            }
+            if (fixed_count != pool.used_count_)
+            {
+                LogError() << "resume pool " << space->symbols_.at(pool.name_id_) << pool << " vptr error. fixed:" << fixed_count;
+                return -1;
+            }
+        }
+        pool.vptr_fixed_ = 1;
+        clock.save();
+        LogInfo() << "resume pool " << space->symbols_.at(pool.name_id_) << pool << ", fixed:" << fixed_count
+            << ", threads:" << workers << ", used:" << clock.duration_ns() / 1000 << "us";
+    }
+    return 0;
+}
+
 
 template <class Frame>
 s32 FrameBoot<Frame>::ResumeShm(const std::string& options)
@@ -170,12 +636,23 @@ s32 FrameBoot<Frame>::ResumeShm(const std::string& options)
         return ret;
     }
 
+    if (conf.boot_conf_.shadow_key_ != 0)
+    {
+        return ShadowResumeShm(conf);
+    }
 
     if (true)
     {
-        zshm_boot booter;
         zshm_space* shm_space = nullptr;
-        ret = booter.resume_frame(conf.space_conf_, shm_space);
+        ret = zshm_boot::attach_frame(conf.space_conf_, shm_space);
+        if (ret == 0)
+        {
+            ret = zshm_boot::check_frame(conf.space_conf_, *shm_space);
+            if (ret == zshm_errno::E_SHM_VERSION_MISMATCH && conf.boot_conf_.migrate_)
+            {
+                ret = MigrateShm(conf, shm_space);
+            }
+        }
         if (ret != 0 || shm_space == nullptr)
         {
             LogError() << "booter.resume_frame error. shm_space:" << (void*)shm_space << ", ret:" << zshm_errno::str(ret);
@@ -183,13 +660,24 @@ s32 FrameBoot<Frame>::ResumeShm(const std::string& options)
         }
         g_shm_space = shm_space;
         //ShmSpace().fixed_ = (u64)shm_space;
+        ReportSpace("resume");
     }
 
+    return ResumeSpace(conf);
+}
 
 
-    
-
+template <class Frame>
+s32 FrameBoot<Frame>::ResumeSpace(FrameConf& conf)
+{
+    s32 ret = 0;
+    FrameEpoch::Recover();
 
+    if (true)
+    {
+        u32 dropped = FrameCommands::Resume();
+        LogInfo() << "resume commands:" << FrameCommands::Ring().size() << ", dropped:" << dropped;
+    }
     if (true)
     {
         zbuddy* buddy_ptr = SubSpace<zbuddy, ShmSpace::kBuddy>();
@@ -205,10 +693,23 @@ s32 FrameBoot<Frame>::ResumeShm(const std::string& options)
 
     if (true)
     {
-        zmalloc* malloc_ptr = SubSpace<zmalloc, ShmSpace::kMalloc>();
+        zmalloc_arenas* arenas_ptr = SubSpace<zmalloc_arenas, ShmSpace::kMalloc>();
+        arenas_ptr->resume(&AllocLarge, &FreeLarge);
+        arenas_ptr->set_slab_threshold(conf.boot_conf_.slab_threshold_);
+        arenas_ptr->set_global(arenas_ptr);
+        zmalloc* malloc_ptr = &arenas_ptr->arena(0);
         malloc_ptr->set_global(malloc_ptr);
-        malloc_ptr->set_block_callback(&AllocLarge, &FreeLarge);
-        malloc_ptr->check_panic();
+        arenas_ptr->check_panic();
+
+        if (ShmSpace().subs_[ShmSpace::kThreadCache].size_ < sizeof(ztcache))
+        {
+            LogError() << "thread cache sub size:" << ShmSpace().subs_[ShmSpace::kThreadCache].size_ << " less than:" << sizeof(ztcache);
+            return zshm_errno::E_INVALID_PARAM;
+        }
+        ztcache* tcache_ptr = SubSpace<ztcache, ShmSpace::kThreadCache>();
+        u64 cached = tcache_ptr->recover(arenas_ptr);
+        tcache_ptr->set_global(tcache_ptr);
+        LogInfo() << "resume thread caches, give back cached chunks:" << cached;
     }
 
     if (true)
@@ -216,23 +717,17 @@ s32 FrameBoot<Frame>::ResumeShm(const std::string& options)
         PoolSpace* space = SubSpace<PoolSpace, ShmSpace::kPool>();
         //space->symbols_.attach(space->names_, kLimitObjectNameBuffSize, kLimitObjectNameBuffSize);
         PoolHelper helper;
-        s32 ret = helper.Attach(conf.pool_conf_, false);
-        if (helper.Diff(space) != 0)
+        ret = helper.Attach(conf.pool_conf_, false);
+        if (ret != 0 || helper.Diff(space) != 0)
         {
             LogError() << "pool version error";
-            return ret;
+            return zshm_errno::E_SHM_VERSION_MISMATCH;
         }
 
-        for (s32 i = 0; i <= space->max_used_id_; i++)
+        ret = ResumePools(space, conf.boot_conf_.resume_threads_);
+        if (ret != 0)
         {
-            //resume object vptr
-            zmem_pool& pool = space->pools_[i];
-            if (pool.obj_count_ == 0)
-            {
-                continue;
-            }
-            pool.resume(space->conf_[i].vptr_);
-            LogDebug() << "has pool " << space->symbols_.at(pool.name_id_) << pool;
+            return ret;
         }
     }
 
@@ -248,14 +743,231 @@ s32 FrameBoot<Frame>::ResumeShm(const std::string& options)
         LogError() << "";
         return ret;
     }
+
+    FrameWorkers::Instance().Start(conf.boot_conf_.tick_threads_);
+    FrameIO::Instance().Start(conf.boot_conf_.io_uring_ != 0, conf.boot_conf_.io_threads_);
+    return 0;
+}
+
+
+template <class Frame>
+s32 FrameBoot<Frame>::SnapshotShm(const std::string& path)
+{
+    if (g_shm_space == nullptr)
+    {
+        LogError() << "no frame.";
+        return zshm_errno::E_NO_SHM_MAPPING;
+    }
+    zclock clock;
+    clock.start();
+    std::array<u64, ZSHM_MAX_SPACES> data_size;
+    u64 total_size = 0;
+    for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+    {
+        data_size[i] = CopySize(ShmSpace(), (const char*)g_shm_space, i);
+        total_size += data_size[i];
+    }
+    SnapshotState& state = Snapshot();
+    state.base_hash_ = 0;
+    s32 ret = zshm_boot::snapshot_frame(ShmSpace(), data_size.data(), path.c_str(), &state.base_hash_);
+    if (ret != 0)
+    {
+        LogError() << "snapshot to " << path << " error. ret:" << zshm_errno::str(ret);
+        return ret;
+    }
+    zshm_boot::remove_deltas(path.c_str());
+    state.path_ = path;
+    state.seq_ = 0;
+    ret = state.tracker_.reset(ShmSpace(), data_size.data());
+    if (ret != 0)
+    {
+        LogWarn() << "reset dirty tracker error, next delta snapshot will be full. ret:" << zshm_errno::str(ret);
+        state.base_hash_ = 0;
+    }
+    clock.save();
+    LogInfo() << "snapshot to " << path << ", data size:" << total_size << ", used:" << clock.duration_ns() / 1000 << "us";
+    return 0;
+}
+
+
+template <class Frame>
+s32 FrameBoot<Frame>::SnapshotDeltaShm(const std::string& path)
+{
+    SnapshotState& state = Snapshot();
+    if (g_shm_space == nullptr || state.base_hash_ == 0 || state.path_ != path)
+    {
+        //no base in this process  
+        return SnapshotShm(path);
+    }
+    zclock clock;
+    clock.start();
+    std::array<u64, ZSHM_MAX_SPACES> data_size;
+    for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+    {
+        data_size[i] = CopySize(ShmSpace(), (const char*)g_shm_space, i);
+    }
+    std::vector<u64> blocks;
+    //producers push commands without the tick, the soft dirty race would lose their pages: store the ring whole.
+    s32 ret = state.tracker_.collect(ShmSpace(), data_size.data(), blocks, 1ULL << ShmSpace::kCommand);
+    if (ret == 0)
+    {
+        ret = zshm_boot::snapshot_delta(ShmSpace(), data_size.data(), blocks, state.tracker_.block_size(), path.c_str(), state.base_hash_, state.seq_ + 1);
+    }
+    if (ret != 0)
+    {
+        //dirty blocks lost, the next one must be full.  
+        state.base_hash_ = 0;
+        LogError() << "delta snapshot to " << path << " error. ret:" << zshm_errno::str(ret);
+        return ret;
+    }
+    state.seq_++;
+    clock.save();
+    LogInfo() << "delta snapshot " << zshm_boot::delta_path(path.c_str(), state.seq_) << ", soft dirty:" << state.tracker_.use_soft_dirty()
+        << ", blocks:" << blocks.size() << ", bytes:" << blocks.size() * state.tracker_.block_size() << ", used:" << clock.duration_ns() / 1000 << "us";
     return 0;
 }
 
 
+template <class Frame>
+s32 FrameBoot<Frame>::CompactSnapshot(const std::string& path)
+{
+    if (g_shm_space == nullptr)
+    {
+        LogError() << "no frame.";
+        return zshm_errno::E_NO_SHM_MAPPING;
+    }
+    zclock clock;
+    clock.start();
+    u64 base_hash = 0;
+    s32 ret = zshm_boot::compact_snapshot(ShmSpace(), path.c_str(), &base_hash);
+    if (ret != 0)
+    {
+        LogError() << "compact snapshot " << path << " error. ret:" << zshm_errno::str(ret);
+        return ret;
+    }
+    SnapshotState& state = Snapshot();
+    if (state.path_ == path)
+    {
+        //the tracker is not reset: new base contains all deltas.  
+        state.base_hash_ = base_hash;
+        state.seq_ = 0;
+    }
+    clock.save();
+    LogInfo() << "compact snapshot " << path << ", used:" << clock.duration_ns() / 1000 << "us";
+    return 0;
+}
+
+
+template <class Frame>
+s32 FrameBoot<Frame>::RestoreShm(const std::string& options, const std::string& path)
+{
+    FrameConf conf;
+    s32 ret = Frame::LoadConfig(options, conf);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    zclock clock;
+    clock.start();
+    zshm_space* shm_space = nullptr;
+    ret = zshm_boot::restore_frame(conf.space_conf_, path.c_str(), shm_space);
+    if (ret != 0 || shm_space == nullptr)
+    {
+        LogError() << "restore from " << path << " error. ret:" << zshm_errno::str(ret);
+        return ret != 0 ? ret : -1;
+    }
+    g_shm_space = shm_space;
+    clock.save();
+    LogInfo() << "restore from " << path << ", used:" << clock.duration_ns() / 1000 << "us";
+    ReportSpace("restore");
+    return ResumeSpace(conf);
+}
+
+
 template <class Frame>
 s32 FrameBoot<Frame>::DoTick(s64 now_ms)
 {
-    return SubSpace<Frame, kMainFrame>()->Tick(now_ms);
+    FrameEpoch::BeginTick();
+    FrameIO::Instance().Reap();
+    FrameTimer::Expire(now_ms);
+    FrameCommands::Drain(now_ms);
+    s32 ret = SubSpace<Frame, kMainFrame>()->Tick(now_ms);
+    FrameIO::Instance().Submit();
+    FrameEpoch::EndTick();
+    return ret;
+}
+
+
+template <class Frame>
+s32 FrameBoot<Frame>::AttachReadOnly(const std::string& options)
+{
+    if (g_shm_space != nullptr)
+    {
+        LogError() << "frame already attached:" << (void*)g_shm_space;
+        return zshm_errno::E_HAS_SHM_MAPPING;
+    }
+    FrameConf conf;
+    s32 ret = Frame::LoadConfig(options, conf);
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    zshm_space params = conf.space_conf_;
+    if (conf.boot_conf_.shadow_key_ != 0)
+    {
+        //the live frame maybe in either key, the larger frame seq is live.  
+        u64 keys[2] = { conf.space_conf_.shm_key_, conf.boot_conf_.shadow_key_ };
+        u64 live_seq = 0;
+        for (s32 i = 0; i < 2; i++)
+        {
+            zshm_loader loader(false, keys[i], 0);
+            if (loader.check() != 0 || loader.attach(0, true) != 0)
+            {
+                continue;
+            }
+            u64 seq = ((const zshm_space*)loader.shm_mnt_addr())->frame_seq_;
+            loader.detach();
+            if (seq > live_seq)
+            {
+                live_seq = seq;
+                params.shm_key_ = keys[i];
+            }
+        }
+    }
+
+    const zshm_space* shm_space = nullptr;
+    ret = zshm_boot::observe_frame(params, shm_space);
+    if (ret != 0 || shm_space == nullptr)
+    {
+        LogError() << "observe_frame error. key:" << params.shm_key_ << ", ret:" << zshm_errno::str(ret);
+        return ret;
+    }
+    ret = zshm_boot::check_frame(params, *shm_space);
+    if (ret != 0)
+    {
+        LogError() << "observe_frame version error. key:" << params.shm_key_ << ", ret:" << zshm_errno::str(ret);
+        zshm_boot::detach_frame(*shm_space);
+        return ret;
+    }
+    g_shm_space = const_cast<zshm_space*>(shm_space);
+    LogInfo() << "observe frame key:" << params.shm_key_ << ", space:" << (void*)g_shm_space << ", frame seq:" << shm_space->frame_seq_
+        << ", tick epoch:" << shm_space->tick_epoch_;
+    return 0;
+}
+
+
+template <class Frame>
+s32 FrameBoot<Frame>::DetachReadOnly()
+{
+    if (g_shm_space == nullptr)
+    {
+        return -1;
+    }
+    s32 ret = zshm_boot::detach_frame(ShmSpace());
+    g_shm_space = nullptr;
+    return ret;
 }
 
 
@@ -268,7 +980,19 @@ s32 FrameBoot<Frame>::ExitShm(const std::string& options)
         return -1;
     }
 
+    FrameWorkers::Instance().Stop();
+    FrameIO::Instance().Stop();
     DestroyObject(SubSpace<Frame, ShmSpace::kMainFrame>());
+    ztcache::set_global(NULL);
+
+    if (!zshm_boot::own_key(ShmSpace()))
+    {
+        //switched to a shadow frame by new process.  
+        LogInfo() << "frame key:" << ShmSpace().shm_key_ << " is owned by new frame, only detach.";
+        zshm_boot::detach_frame(ShmSpace());
+        g_shm_space = nullptr;
+        return 0;
+    }
 
     s32 ret = zshm_boot::destroy_frame(ShmSpace());
     if (ret != 0)
@@ -295,6 +1019,14 @@ s32 FrameBoot<Frame>::DelShm(const std::string& options)
 
     zshm_boot booter;
     ret = booter.destroy_frame(conf.space_conf_);
+    if (conf.boot_conf_.shadow_key_ != 0)
+    {
+        //live frame maybe in any key  
+        zshm_space shadow = conf.space_conf_;
+        shadow.shm_key_ = conf.boot_conf_.shadow_key_;
+        s32 shadow_ret = booter.destroy_frame(shadow);
+        ret = ret == 0 ? ret : shadow_ret;
+    }
     if (ret != 0)
     {
         LogError() << "Destroy shm has error:" << zshm_errno::str(ret) <<", please used ipcs -m/ ipcrm -m to destroy it. ";
@@ -0,0 +1,100 @@
+/*
+* Copyright (C) 2019 YaweiZhang <yawei.zhang@foxmail.com>.
+* All rights reserved
+* This file is part of the zframe, used MIT License.
+*/
+
+
+#ifndef FRAME_COMMANDS_H_
+#define FRAME_COMMANDS_H_
+
+#include "frame_def.h"
+#include "frame_option.h"
+
+
+/*
+* commands from network/io threads to the tick thread: a mpsc ring in kCommand sub space.
+* Push is lock free from any thread, DoTick drains at most kCommandDrainBatch commands after timers.
+* pushed commands not drained yet are kept in shm and drained by the resumed frame.
+* the shm only keeps command type, handlers are registered by type in every process (Start/Resume).
+*/
+
+
+using CommandHandler = s32(*)(u32 type, const char* data, u32 len, s64 now_ms);
+
+
+class FrameCommands
+{
+public:
+    static inline zmpsc_ring& Ring() { return *SubSpace<zmpsc_ring, ShmSpace::kCommand>(); }
+
+    static inline s32 Build()
+    {
+        if (ShmSpace().subs_[ShmSpace::kCommand].size_ < (u64)kCommandSpaceSize)
+        {
+            return zshm_errno::E_INVALID_PARAM; //slots would run past the sub space
+        }
+        zmpsc_ring& ring = Ring();
+        char* slots = (char*)zmpsc_ring::align_line((u64)&ring + sizeof(zmpsc_ring));
+        return ring.init(kCommandPayloadSize, kLimitCommandCount, slots, (char*)&ring + kCommandSpaceSize - slots);
+    }
+
+    //return dropped slots (claimed by a producer of the old process but never published).
+    static inline u32 Resume()
+    {
+        return Ring().recover();
+    }
+
+    static inline s32 Register(u32 type, CommandHandler handler)
+    {
+        if (type >= kLimitCommandTypes)
+        {
+            return -1;
+        }
+        Handlers()[type] = handler;
+        return 0;
+    }
+
+    //any thread. 0 success, -1 full, -2 too large, -3 invalid type
+    static inline s32 Push(u32 type, const void* data, u32 len)
+    {
+        if (type >= kLimitCommandTypes)
+        {
+            return -3;
+        }
+        return Ring().push(type, data, len);
+    }
+
+    template<class _Ty>
+    static inline s32 Push(u32 type, const _Ty& cmd)
+    {
+        static_assert(std::is_trivially_copyable<_Ty>::value, "");
+        return Push(type, &cmd, (u32)sizeof(_Ty));
+    }
+
+    //tick thread only.
+    static inline u32 Drain(s64 now_ms, u32 max_count = kCommandDrainBatch)
+    {
+        CommandHandler* handlers = Handlers();
+        return Ring().drain(max_count, [handlers, now_ms](u32 type, const char* data, u32 len)
+            {
+                CommandHandler handler = handlers[type];
+                if (handler == nullptr)
+                {
+                    LogError() << "command type:" << type << " len:" << len << " not registered.";
+                    return;
+                }
+                handler(type, data, len, now_ms);
+            });
+    }
+
+private:
+    static inline CommandHandler* Handlers()
+    {
+        static CommandHandler handlers[kLimitCommandTypes] = { nullptr };
+        return handlers;
+    }
+};
+
+
+#endif
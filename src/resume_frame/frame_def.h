@@ -81,6 +81,11 @@ using f64 = double;
 #include "zshm_boot.h"
 
 #include "zmem_pool.h"
+#include "zsoa_pool.h"
+#include "ztimer_wheel.h"
+#include "zmpsc_ring.h"
+#include "zmalloc_arenas.h"
+#include "ztcache.h"
 #include "zforeach.h"
 #include "zsymbols.h"
 #include "zclock.h"
@@ -0,0 +1,541 @@
+/*
+* Copyright (C) 2019 YaweiZhang <yawei.zhang@foxmail.com>.
+* All rights reserved
+* This file is part of the zframe, used MIT License.
+*/
+
+
+#ifndef FRAME_IO_H_
+#define FRAME_IO_H_
+
+#include "frame_def.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <deque>
+
+#ifndef WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#else
+#define IORING_ENTER_GETEVENTS 1
+#endif
+
+
+/*
+* async file io of this process (not in shm, start again after resume, in flight requests of a dead process are lost).
+* the tick thread queues read/write/fsync, DoTick reaps completions before timers and submits queued requests after Tick,
+* callbacks always run in the tick thread.
+* backend: io_uring (raw syscalls, linux 5.6+) -> worker threads (pread/pwrite) -> sync in the caller when not started.
+* the buffer is owned by the caller until its callback. the slot of a request is free before its callback,
+* so a callback can queue one new request without stall, more ones are refused (-1) when the table is full.
+*/
+
+
+using IOCallback = void(*)(u64 userdata, s64 result); //result: bytes or -errno
+
+
+class FrameIO
+{
+public:
+    enum IOOp : u32
+    {
+        kIORead,
+        kIOWrite,
+        kIOFsync, //ordered after all requests queued before it and before all after it (io_uring drain, worker barrier)
+    };
+    enum IOBackend : u32
+    {
+        kIOSync,
+        kIOThreads,
+        kIOUring,
+    };
+    static constexpr u32 kDefaultDepth = 256;
+
+    static FrameIO& Instance()
+    {
+        static FrameIO io;
+        return io;
+    }
+
+    ~FrameIO() { Stop(); }
+
+    s32 Start(bool use_uring, s32 threads, u32 depth = kDefaultDepth)
+    {
+        Stop();
+        stalls_ = 0;
+        depth = depth == 0 ? kDefaultDepth : depth;
+        reqs_.resize(depth);
+        free_ids_.clear();
+        for (u32 i = depth; i > 0; i--)
+        {
+            free_ids_.push_back(i - 1);
+        }
+        if (use_uring && UringSetup(depth) == 0)
+        {
+            backend_ = kIOUring;
+            return 0;
+        }
+        if (threads > 0)
+        {
+            exit_ = false;
+            for (s32 i = 0; i < threads; i++)
+            {
+                threads_.emplace_back(&FrameIO::Work, this);
+            }
+            backend_ = kIOThreads;
+            return 0;
+        }
+        backend_ = kIOSync;
+        return 0;
+    }
+
+    void Stop()
+    {
+        Wait();
+        if (backend_ == kIOThreads)
+        {
+            {
+                std::lock_guard<std::mutex> l(lock_);
+                exit_ = true;
+            }
+            wake_.notify_all();
+            for (auto& t : threads_)
+            {
+                t.join();
+            }
+            threads_.clear();
+        }
+        if (backend_ == kIOUring)
+        {
+            UringClose();
+        }
+        backend_ = kIOSync;
+    }
+
+    IOBackend Backend() const { return backend_; }
+    u32 InFlight() const { return in_flight_; }
+    u64 Stalls() const { return stalls_; }
+
+    //0 queued, -1 invalid or busy (queued in a callback when the table is full)
+    s32 Read(s32 fd, void* buf, u32 len, s64 offset, IOCallback cb, u64 userdata) { return Queue(kIORead, fd, buf, len, offset, cb, userdata); }
+    s32 Write(s32 fd, const void* buf, u32 len, s64 offset, IOCallback cb, u64 userdata) { return Queue(kIOWrite, fd, (void*)buf, len, offset, cb, userdata); }
+    s32 Fsync(s32 fd, IOCallback cb, u64 userdata) { return Queue(kIOFsync, fd, nullptr, 0, 0, cb, userdata); }
+
+    //hand queued requests to the kernel/workers, never blocks.
+    void Submit()
+    {
+        if (backend_ == kIOUring)
+        {
+            UringEnter(0, 0);
+        }
+        else if (backend_ == kIOThreads && !pending_.empty())
+        {
+            {
+                std::lock_guard<std::mutex> l(lock_);
+                for (u32 id : pending_)
+                {
+                    queue_.push_back(id);
+                }
+            }
+            pending_.clear();
+            wake_.notify_all();
+        }
+    }
+
+    //run callbacks of completed requests, never blocks. not reentrant: reap in a callback returns 0.
+    u32 Reap()
+    {
+        if (reaping_active_)
+        {
+            return 0;
+        }
+        reaping_active_ = true;
+        u32 count = 0;
+        if (backend_ == kIOUring)
+        {
+            count = UringReap();
+        }
+        else
+        {
+            if (backend_ == kIOThreads)
+            {
+                std::lock_guard<std::mutex> l(done_lock_);
+                reaping_.swap(done_);
+            }
+            else
+            {
+                reaping_.swap(done_);
+            }
+            for (const Done& d : reaping_)
+            {
+                Complete(d.id_, d.result_);
+            }
+            count = (u32)reaping_.size();
+            reaping_.clear();
+        }
+        reaping_active_ = false;
+        return count;
+    }
+
+    //block until all requests done (exit, or before reuse of the buffers).
+    void Wait()
+    {
+        while (in_flight_ > 0)
+        {
+            Submit(); //requests queued by callbacks
+            if (Reap() == 0)
+            {
+                WaitOne();
+            }
+        }
+    }
+
+private:
+    struct Request
+    {
+        IOOp op_;
+        s32 fd_;
+        void* buf_;
+        u32 len_;
+        s64 offset_;
+        IOCallback cb_;
+        u64 userdata_;
+    };
+    struct Done
+    {
+        u32 id_;
+        s64 result_;
+    };
+
+    s32 Queue(IOOp op, s32 fd, void* buf, u32 len, s64 offset, IOCallback cb, u64 userdata)
+    {
+        if (fd < 0 || reqs_.empty())
+        {
+            return -1;
+        }
+        while (free_ids_.empty())
+        {
+            //in a callback no completion can be reaped, stalling would never end.
+            if (reaping_active_)
+            {
+                return -1;
+            }
+            //queue depth used up: the tick thread stalls for one completion.
+            stalls_++;
+            Submit();
+            if (Reap() == 0)
+            {
+                WaitOne();
+            }
+        }
+        u32 id = free_ids_.back();
+        free_ids_.pop_back();
+        reqs_[id] = { op, fd, buf, len, offset, cb, userdata };
+        in_flight_++;
+        if (backend_ == kIOUring)
+        {
+            UringQueue(id);
+        }
+        else if (backend_ == kIOThreads)
+        {
+            pending_.push_back(id);
+        }
+        else
+        {
+            done_.push_back({ id, Execute(reqs_[id]) });
+        }
+        return 0;
+    }
+
+    void Complete(u32 id, s64 result)
+    {
+        Request req = reqs_[id];
+        free_ids_.push_back(id);
+        in_flight_--;
+        if (req.cb_ != nullptr)
+        {
+            req.cb_(req.userdata_, result);
+        }
+    }
+
+    void WaitOne()
+    {
+        if (backend_ == kIOUring)
+        {
+            UringEnter(1, IORING_ENTER_GETEVENTS);
+        }
+        else if (backend_ == kIOThreads)
+        {
+            std::unique_lock<std::mutex> l(done_lock_);
+            done_wake_.wait(l, [this]() { return !done_.empty(); });
+        }
+    }
+
+    static s64 Execute(const Request& req)
+    {
+#ifndef WIN32
+        ssize_t ret = 0;
+        switch (req.op_)
+        {
+        case kIORead:
+            ret = req.offset_ >= 0 ? pread(req.fd_, req.buf_, req.len_, req.offset_) : read(req.fd_, req.buf_, req.len_);
+            break;
+        case kIOWrite:
+            ret = req.offset_ >= 0 ? pwrite(req.fd_, req.buf_, req.len_, req.offset_) : write(req.fd_, req.buf_, req.len_);
+            break;
+        case kIOFsync:
+            ret = fsync(req.fd_);
+            break;
+        }
+        return ret < 0 ? -(s64)errno : (s64)ret;
+#else
+        return -1;
+#endif
+    }
+
+    //hold lock_. fsync starts when no other request running, and nothing starts while it runs.
+    bool Takeable() const
+    {
+        if (queue_.empty() || barrier_)
+        {
+            return false;
+        }
+        return reqs_[queue_.front()].op_ != kIOFsync || running_ == 0;
+    }
+
+    void Work()
+    {
+        while (true)
+        {
+            u32 id = 0;
+            {
+                std::unique_lock<std::mutex> l(lock_);
+                wake_.wait(l, [this]() { return (exit_ && queue_.empty()) || Takeable(); });
+                if (queue_.empty())
+                {
+                    return;
+                }
+                id = queue_.front();
+                queue_.pop_front();
+                running_++;
+                barrier_ = reqs_[id].op_ == kIOFsync;
+            }
+            s64 result = Execute(reqs_[id]);
+            bool idle = false;
+            {
+                std::lock_guard<std::mutex> l(lock_);
+                running_--;
+                barrier_ = false;
+                idle = running_ == 0;
+            }
+            if (idle)
+            {
+                wake_.notify_all(); //a fsync at the front waits all running done
+            }
+            {
+                std::lock_guard<std::mutex> l(done_lock_);
+                done_.push_back({ id, result });
+            }
+            done_wake_.notify_one();
+        }
+    }
+
+#ifdef __linux__
+    s32 UringSetup(u32 depth)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        s32 fd = (s32)syscall(__NR_io_uring_setup, depth, &params);
+        if (fd < 0)
+        {
+            LogWarn() << "io_uring_setup error:" << errno << ", fallback to threads.";
+            return -1;
+        }
+        //IORING_OP_READ/WRITE come with RW_CUR_POS (5.6)
+        if (!(params.features & IORING_FEAT_RW_CUR_POS))
+        {
+            LogWarn() << "io_uring too old, features:" << params.features << ", fallback to threads.";
+            close(fd);
+            return -2;
+        }
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(u32);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        single_mmap_ = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap_)
+        {
+            sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        }
+        sq_ptr_ = (char*)mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cq_ptr_ = single_mmap_ ? sq_ptr_ : (char*)mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = (io_uring_sqe*)mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        ring_fd_ = fd;
+        if (sq_ptr_ == MAP_FAILED || cq_ptr_ == MAP_FAILED || (void*)sqes_ == MAP_FAILED)
+        {
+            LogWarn() << "io_uring mmap error:" << errno << ", fallback to threads.";
+            UringClose();
+            return -3;
+        }
+        sq_head_ = (std::atomic<u32>*)(sq_ptr_ + params.sq_off.head);
+        sq_tail_ = (std::atomic<u32>*)(sq_ptr_ + params.sq_off.tail);
+        sq_mask_ = *(u32*)(sq_ptr_ + params.sq_off.ring_mask);
+        sq_entries_ = params.sq_entries;
+        sq_array_ = (u32*)(sq_ptr_ + params.sq_off.array);
+        cq_head_ = (std::atomic<u32>*)(cq_ptr_ + params.cq_off.head);
+        cq_tail_ = (std::atomic<u32>*)(cq_ptr_ + params.cq_off.tail);
+        cq_mask_ = *(u32*)(cq_ptr_ + params.cq_off.ring_mask);
+        cqes_ = (io_uring_cqe*)(cq_ptr_ + params.cq_off.cqes);
+        to_submit_ = 0;
+        return 0;
+    }
+
+    void UringClose()
+    {
+        if (sqes_ != nullptr && (void*)sqes_ != MAP_FAILED)
+        {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ptr_ != nullptr && cq_ptr_ != MAP_FAILED && !single_mmap_)
+        {
+            munmap(cq_ptr_, cq_size_);
+        }
+        if (sq_ptr_ != nullptr && sq_ptr_ != MAP_FAILED)
+        {
+            munmap(sq_ptr_, sq_size_);
+        }
+        if (ring_fd_ >= 0)
+        {
+            close(ring_fd_);
+        }
+        sqes_ = nullptr;
+        sq_ptr_ = nullptr;
+        cq_ptr_ = nullptr;
+        ring_fd_ = -1;
+    }
+
+    void UringQueue(u32 id)
+    {
+        u32 tail = sq_tail_->load(std::memory_order_relaxed);
+        while (tail - sq_head_->load(std::memory_order_acquire) >= sq_entries_)
+        {
+            //sq full: queue depth is larger than sq entries
+            UringEnter(0, 0);
+        }
+        const Request& req = reqs_[id];
+        u32 index = tail & sq_mask_;
+        io_uring_sqe* sqe = &sqes_[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = req.op_ == kIORead ? IORING_OP_READ : (req.op_ == kIOWrite ? IORING_OP_WRITE : IORING_OP_FSYNC);
+        sqe->flags = req.op_ == kIOFsync ? IOSQE_IO_DRAIN : 0;
+        sqe->fd = req.fd_;
+        sqe->addr = (u64)req.buf_;
+        sqe->len = req.len_;
+        sqe->off = (u64)req.offset_; //-1: current file position
+        sqe->user_data = id;
+        sq_array_[index] = index;
+        sq_tail_->store(tail + 1, std::memory_order_release);
+        to_submit_++;
+    }
+
+    void UringEnter(u32 min_complete, u32 flags)
+    {
+        if (to_submit_ == 0 && min_complete == 0)
+        {
+            return;
+        }
+        s32 ret = (s32)syscall(__NR_io_uring_enter, ring_fd_, to_submit_, min_complete, flags, nullptr, 0);
+        if (ret < 0)
+        {
+            if (errno != EAGAIN && errno != EBUSY && errno != EINTR)
+            {
+                LogError() << "io_uring_enter error:" << errno;
+            }
+            return;
+        }
+        to_submit_ -= std::min((u32)ret, to_submit_);
+    }
+
+    u32 UringReap()
+    {
+        u32 count = 0;
+        u32 head = cq_head_->load(std::memory_order_relaxed);
+        while (head != cq_tail_->load(std::memory_order_acquire))
+        {
+            const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+            u32 id = (u32)cqe.user_data;
+            s64 result = cqe.res;
+            head++;
+            cq_head_->store(head, std::memory_order_release);
+            Complete(id, result);
+            count++;
+        }
+        return count;
+    }
+#else
+    s32 UringSetup(u32 depth) { return -1; }
+    void UringClose() {}
+    void UringQueue(u32 id) {}
+    void UringEnter(u32 min_complete, u32 flags) {}
+    u32 UringReap() { return 0; }
+#endif
+
+private:
+    IOBackend backend_ = kIOSync;
+    std::vector<Request> reqs_;
+    std::vector<u32> free_ids_;
+    u32 in_flight_ = 0;
+    u64 stalls_ = 0;
+    bool reaping_active_ = false;
+
+    //threads and sync
+    std::vector<u32> pending_; //queued in this tick, handed to workers by Submit
+    std::deque<u32> queue_;
+    std::vector<Done> done_;
+    std::vector<Done> reaping_;
+    std::vector<std::thread> threads_;
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::mutex done_lock_;
+    std::condition_variable done_wake_;
+    u32 running_ = 0; //taken by workers, not done
+    bool barrier_ = false; //a fsync is running
+    bool exit_ = false;
+
+    //io_uring
+    s32 ring_fd_ = -1;
+    bool single_mmap_ = false;
+    char* sq_ptr_ = nullptr;
+    char* cq_ptr_ = nullptr;
+    u64 sq_size_ = 0;
+    u64 cq_size_ = 0;
+    u64 sqes_size_ = 0;
+#ifdef __linux__
+    io_uring_sqe* sqes_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+#else
+    void* sqes_ = nullptr;
+    void* cqes_ = nullptr;
+#endif
+    std::atomic<u32>* sq_head_ = nullptr;
+    std::atomic<u32>* sq_tail_ = nullptr;
+    u32* sq_array_ = nullptr;
+    u32 sq_mask_ = 0;
+    u32 sq_entries_ = 0;
+    std::atomic<u32>* cq_head_ = nullptr;
+    std::atomic<u32>* cq_tail_ = nullptr;
+    u32 cq_mask_ = 0;
+    u32 to_submit_ = 0;
+};
+
+
+#endif
@@ -0,0 +1,125 @@
+/*
+* Copyright (C) 2019 YaweiZhang <yawei.zhang@foxmail.com>.
+* All rights reserved
+* This file is part of the zframe, used MIT License.
+*/
+
+
+#ifndef FRAME_OBSERVER_H_
+#define FRAME_OBSERVER_H_
+
+#include "frame_def.h"
+#include "frame_option.h"
+#include <atomic>
+#include <thread>
+
+
+/*
+* read-only observers of a live frame (monitor/gm tools in other processes).
+* the observer maps the frame with FrameBoot<Frame>::AttachReadOnly at the same fixed address,
+* so pointers in shm are valid. vptrs are the owner's and never fixed: read members, never call virtual functions.
+* the owner bumps tick_epoch_ of the shm head around every DoTick (seqlock, odd while ticking),
+* FrameEpoch::Read runs the read again until it saw no tick in the middle.
+*/
+
+
+class FrameEpoch
+{
+public:
+    static_assert(sizeof(std::atomic<u64>) == sizeof(u64), "");
+
+    static inline std::atomic<u64>& Epoch() { return *reinterpret_cast<std::atomic<u64>*>(&g_shm_space->tick_epoch_); }
+
+    //owner side
+    static inline void BeginTick()
+    {
+        std::atomic<u64>& epoch = Epoch();
+        epoch.store(epoch.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    static inline void EndTick()
+    {
+        std::atomic<u64>& epoch = Epoch();
+        epoch.store(epoch.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    //the owner crashed in tick. called when resume.
+    static inline void Recover()
+    {
+        std::atomic<u64>& epoch = Epoch();
+        if (epoch.load(std::memory_order_relaxed) & 1)
+        {
+            EndTick();
+        }
+    }
+
+    /*
+    * observer side: fn copies what it needs out of the frame, it maybe see a frame in the middle of tick,
+    * so fn must tolerate bad values (check ids and sizes) and the copy is dropped when the epoch changed.
+    * return 0 when fn read a stable frame, -1 is failed after max_retry.
+    */
+    template<class Fn>
+    static inline s32 Read(Fn&& fn, s32 max_retry = 100)
+    {
+        std::atomic<u64>& epoch = Epoch();
+        for (s32 i = 0; i < max_retry; i++)
+        {
+            u64 begin = epoch.load(std::memory_order_acquire);
+            if (begin & 1)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            fn();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (epoch.load(std::memory_order_relaxed) == begin)
+            {
+                return 0;
+            }
+        }
+        return -1;
+    }
+};
+
+
+//typed read-only view of one pool.
+template<class _Ty>
+class PoolView
+{
+public:
+    explicit PoolView(u32 pool_id) : pool_(pool_id < (u32)kLimitObjectCount ? &SubSpace<PoolSpace, ShmSpace::kPool>()->pools_[pool_id] : nullptr) {}
+
+    inline bool valid() const { return pool_ != nullptr && pool_->max_size() > 0 && pool_->chunk_size() >= (s32)sizeof(_Ty); }
+    inline s32 size() const { return pool_->size(); }
+    inline s32 max_size() const { return pool_->max_size(); }
+    inline s32 window_size() const { return std::min(pool_->window_size(), pool_->max_size()); }
+
+    //nullptr when chunk not used.
+    inline const _Ty* at(s32 chunk_id) const
+    {
+        if (chunk_id < 0 || chunk_id >= window_size() || !pool_->ref(chunk_id)->used_)
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<const _Ty*>(pool_->at(chunk_id));
+    }
+
+    //fn(chunk_id, const _Ty&) for every used chunk.
+    template<class Fn>
+    inline void foreach(Fn&& fn) const
+    {
+        s32 end_id = window_size();
+        for (s32 i = 0; i < end_id; i++)
+        {
+            if (pool_->ref(i)->used_)
+            {
+                fn(i, *reinterpret_cast<const _Ty*>(pool_->at(i)));
+            }
+        }
+    }
+
+private:
+    zmem_pool* pool_;
+};
+
+
+#endif
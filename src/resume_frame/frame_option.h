@@ -28,6 +28,9 @@ enum  ShmSpace : u32
     kBuddy,
     kMalloc,
     kHeap,
+    kTimer,
+    kCommand,
+    kThreadCache,
 };
 
 
@@ -44,8 +47,11 @@ struct PoolConf
     s32 obj_size_;
     s32 obj_count_;
     s32 name_id_;
+    s32 with_bitmap_; //keep a used bitmap, foreach only visit used objects by it   
     s64 space_size_;
     u64 vptr_; //0 is no vptr 
+    s32 column_count_; //soa columns of hot members, placed after the pool chunks    
+    s32 column_size_[zsoa_pool::MAX_COLUMNS];
 };
 
 
@@ -57,7 +63,9 @@ struct PoolSpace
     char names_[kLimitObjectNameBuffSize];
 
     //runtime states
+    u64 layout_version_; //+1 when migrate to a new layout  
     zmem_pool pools_[kLimitObjectCount];
+    zsoa_pool soas_[kLimitObjectCount]; //same chunk id as pools_  
     zsymbols symbols_;
 };
 
@@ -65,12 +73,45 @@ struct PoolSpace
 constexpr static s64 kPoolSpaceHeadSize = sizeof(PoolSpace);
 
 
+constexpr static s32 kLimitTimerCount = 64 * 1024;
+constexpr static u32 kLimitTimerCallbacks = 256;
+constexpr static s64 kTimerSpaceSize = sizeof(ztimer_wheel) + ztimer_wheel::calculate_space_size(kLimitTimerCount);
+
+
+constexpr static u32 kCommandPayloadSize = 256 - zmpsc_ring::SLOT_HEAD; //one slot is 4 cache lines  
+constexpr static u32 kLimitCommandCount = 16 * 1024; //power of 2  
+constexpr static u32 kLimitCommandTypes = 256;
+constexpr static u32 kCommandDrainBatch = 4096; //max commands drained in one tick  
+constexpr static s64 kCommandSpaceSize = sizeof(zmpsc_ring) + zmpsc_ring::CACHE_LINE + zmpsc_ring::calculate_space_size(kCommandPayloadSize, kLimitCommandCount);
+
+
+constexpr static s32 kLimitFrameStages = 32;
+constexpr static s32 kPoolMaskWords = (kLimitObjectCount + 63) / 64;
+
+
+
+
+//boot options, only used by build/resume, not saved in shm.  
+struct BootConf
+{
+    s32 prefault_; //touch all sub spaces when build  
+    s32 prefault_threads_; //max threads for one large sub space  
+    s32 numa_node_; //-1: no bind  
+    s32 migrate_; //resume: migrate to new layout when only pool space grows  
+    u64 shadow_key_; //resume: 0 off, else resume on a copy in the other key and switch to it after success  
+    s32 resume_threads_; //resume: max threads to fix vptr of one pool  
+    s32 tick_threads_; //tick: worker threads for thread safe foreachs, 0 run all in tick thread  
+    s32 io_uring_; //async io: try io_uring first  
+    s32 io_threads_; //async io: worker threads when io_uring not used or not available, 0 sync io in tick thread  
+    u32 slab_threshold_; //zmalloc: requests not more than it use header-less slab slots, 0 off  
+};
 
 
 struct FrameConf
 {
     zshm_space space_conf_;
     PoolSpace pool_conf_;
+    BootConf boot_conf_;
 };
 
 
@@ -0,0 +1,200 @@
+/*
+* Copyright (C) 2019 YaweiZhang <yawei.zhang@foxmail.com>.
+* All rights reserved
+* This file is part of the zframe, used MIT License.
+*/
+
+
+#ifndef FRAME_STAGES_H_
+#define FRAME_STAGES_H_
+
+#include "frame_def.h"
+#include "frame_option.h"
+#include "frame_workers.h"
+#include <initializer_list>
+
+
+/*
+* stage graph of the frame tick.
+* every stage declares the pools it reads and writes. a stage depends on all earlier declared stages
+* it conflicts with (write-write, write-read, read-write on the same pool), and is placed in the wave
+* after the latest of them. waves run in order, stages of one wave are independent:
+* thread safe stages run on FrameWorkers, others run on the tick thread (so they can use workers themselves).
+* the graph is in the frame (shm), hooks are code ptrs and are added again in Start/Resume.
+* cost of every stage is recorded to a zprof declare node.
+*/
+
+
+using StageTick = s32(*)(void* userdata, s64 now_ms);
+
+
+struct PoolMask
+{
+    u64 bits_[kPoolMaskWords];
+
+    PoolMask() { memset(bits_, 0, sizeof(bits_)); }
+    PoolMask(std::initializer_list<u32> pool_ids) : PoolMask()
+    {
+        for (u32 pool_id : pool_ids)
+        {
+            set(pool_id);
+        }
+    }
+    inline void set(u32 pool_id)
+    {
+        if (pool_id < (u32)kLimitObjectCount)
+        {
+            bits_[pool_id / 64] |= 1ULL << (pool_id % 64);
+        }
+    }
+    inline bool has(u32 pool_id) const { return pool_id < (u32)kLimitObjectCount && (bits_[pool_id / 64] & (1ULL << (pool_id % 64))) != 0; }
+    inline bool overlap(const PoolMask& other) const
+    {
+        for (s32 i = 0; i < kPoolMaskWords; i++)
+        {
+            if ((bits_[i] & other.bits_[i]) != 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+
+struct FrameStage
+{
+    const char* name_;
+    StageTick tick_;
+    void* userdata_;
+    PoolMask reads_;
+    PoolMask writes_;
+    u32 thread_safe_;
+    u32 wave_;
+    s64 cost_cycles_; //last tick
+    u64 ticks_;
+};
+
+
+class FrameStages
+{
+public:
+    static constexpr s32 kProfBeginID = ProfInstType::declare_begin_id();
+    static_assert(kLimitFrameStages <= PROF_DECLARE_COUNT, "");
+
+    //clear all stages, called in Start/Resume before add stages.
+    inline void reset()
+    {
+        count_ = 0;
+        waves_ = 0;
+        for (FrameStage& stage : stages_)
+        {
+            stage = FrameStage();
+        }
+    }
+
+    inline s32 count() const { return count_; }
+    inline u32 waves() const { return waves_; }
+    inline const FrameStage& stage(s32 stage_id) const { return stages_[stage_id]; }
+
+    //return stage id, negative is error. stages with a conflict keep the declared order.
+    inline s32 add(const char* name, StageTick tick, void* userdata, const PoolMask& reads, const PoolMask& writes, bool thread_safe = true)
+    {
+        if (name == nullptr || tick == nullptr)
+        {
+            return -1;
+        }
+        if (count_ >= kLimitFrameStages)
+        {
+            LogError() << "stage:" << name << " out of limit:" << kLimitFrameStages;
+            return -2;
+        }
+        FrameStage& stage = stages_[count_];
+        stage.name_ = name;
+        stage.tick_ = tick;
+        stage.userdata_ = userdata;
+        stage.reads_ = reads;
+        stage.writes_ = writes;
+        stage.thread_safe_ = thread_safe ? 1 : 0;
+        stage.wave_ = 0;
+        stage.cost_cycles_ = 0;
+        stage.ticks_ = 0;
+        for (s32 i = 0; i < count_; i++)
+        {
+            const FrameStage& prev = stages_[i];
+            if (prev.writes_.overlap(stage.writes_) || prev.writes_.overlap(stage.reads_) || prev.reads_.overlap(stage.writes_))
+            {
+                stage.wave_ = std::max(stage.wave_, prev.wave_ + 1);
+            }
+        }
+        waves_ = std::max(waves_, stage.wave_ + 1);
+        PROF_REGIST_NODE(kProfBeginID + count_, name, PROF_COUNTER_DEFAULT, false, true);
+        return count_++;
+    }
+
+    //tick all stages wave by wave, the workers barrier is between waves.
+    inline s32 run(s64 now_ms)
+    {
+        FrameWorkers& workers = FrameWorkers::Instance();
+        for (u32 wave = 0; wave < waves_; wave++)
+        {
+            for (s32 i = 0; i < count_; i++)
+            {
+                if (stages_[i].wave_ == wave && !stages_[i].thread_safe_)
+                {
+                    Execute(i, now_ms);
+                }
+            }
+            for (s32 i = 0; i < count_; i++)
+            {
+                if (stages_[i].wave_ == wave && stages_[i].thread_safe_)
+                {
+                    workers.Post(&FrameStages::Task, this, (u32)i, (u32)i + 1, now_ms);
+                }
+            }
+            workers.Run();
+            for (s32 i = 0; i < count_; i++)
+            {
+                if (stages_[i].wave_ == wave)
+                {
+                    PROF_RECORD_CPU(kProfBeginID + i, stages_[i].cost_cycles_);
+                }
+            }
+        }
+        return 0;
+    }
+
+    inline void report(const char* desc)
+    {
+        for (s32 i = 0; i < count_; i++)
+        {
+            const FrameStage& stage = stages_[i];
+            LogInfo() << desc << " stage:" << stage.name_ << " wave:" << stage.wave_ << (stage.thread_safe_ ? " workers" : " tick thread") << " ticks:" << stage.ticks_;
+            PROF_OUTPUT_RECORD(kProfBeginID + i);
+        }
+    }
+
+private:
+    inline void Execute(s32 stage_id, s64 now_ms)
+    {
+        FrameStage& stage = stages_[stage_id];
+        PROF_DEFINE_COUNTER(cost);
+        PROF_START_COUNTER(cost);
+        stage.tick_(stage.userdata_, now_ms);
+        stage.cost_cycles_ = PROF_STOP_AND_SAVE_COUNTER(cost).cycles();
+        stage.ticks_++;
+    }
+
+    static void Task(void* inst, u32 begin_id, u32 end_id, s64 now_ms)
+    {
+        ((FrameStages*)inst)->Execute((s32)begin_id, now_ms);
+    }
+
+private:
+    s32 count_ = 0;
+    u32 waves_ = 0;
+    FrameStage stages_[kLimitFrameStages];
+};
+
+
+#endif
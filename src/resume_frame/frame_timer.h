@@ -0,0 +1,89 @@
+/*
+* Copyright (C) 2019 YaweiZhang <yawei.zhang@foxmail.com>.
+* All rights reserved
+* This file is part of the zframe, used MIT License.
+*/
+
+
+#ifndef FRAME_TIMER_H_
+#define FRAME_TIMER_H_
+
+#include "frame_def.h"
+#include "frame_option.h"
+
+
+/*
+* timers of frame: the wheel and nodes are in kTimer sub space and resume with frame.
+* the shm only keeps callback id, callbacks are registered by id in every process (Start/Resume).
+* expired timers are fired in DoTick before the frame Tick.
+*/
+
+
+using TimerCallback = s32(*)(u64 timer_id, u64 userdata, s64 now_ms);
+
+
+class FrameTimer
+{
+public:
+    static inline ztimer_wheel& Wheel() { return *SubSpace<ztimer_wheel, ShmSpace::kTimer>(); }
+
+    static inline s32 Build(s64 now_ms)
+    {
+        if (ShmSpace().subs_[ShmSpace::kTimer].size_ < (u64)kTimerSpaceSize)
+        {
+            return zshm_errno::E_INVALID_PARAM; //wheel nodes would run past the sub space
+        }
+        ztimer_wheel& wheel = Wheel();
+        return wheel.init(kLimitTimerCount, (char*)&wheel + sizeof(ztimer_wheel), kTimerSpaceSize - sizeof(ztimer_wheel), now_ms);
+    }
+
+    static inline s32 Register(u32 callback_id, TimerCallback callback)
+    {
+        if (callback_id >= kLimitTimerCallbacks)
+        {
+            return -1;
+        }
+        Callbacks()[callback_id] = callback;
+        return 0;
+    }
+
+    //return timer id, 0 is failed.
+    static inline u64 Add(s64 expire_ms, u32 callback_id, u64 userdata)
+    {
+        if (callback_id >= kLimitTimerCallbacks)
+        {
+            return 0;
+        }
+        return Wheel().add(expire_ms, callback_id, userdata);
+    }
+
+    static inline s32 Cancel(u64 timer_id)
+    {
+        return Wheel().cancel(timer_id);
+    }
+
+    static inline u32 Expire(s64 now_ms)
+    {
+        TimerCallback* callbacks = Callbacks();
+        return Wheel().expire(now_ms, [callbacks, now_ms](u64 timer_id, u32 callback_id, u64 userdata, s64 expire_ms)
+            {
+                TimerCallback callback = callbacks[callback_id];
+                if (callback == nullptr)
+                {
+                    LogError() << "timer:" << timer_id << " callback id:" << callback_id << " not registered, expire ms:" << expire_ms;
+                    return;
+                }
+                callback(timer_id, userdata, now_ms);
+            });
+    }
+
+private:
+    static inline TimerCallback* Callbacks()
+    {
+        static TimerCallback callbacks[kLimitTimerCallbacks] = { nullptr };
+        return callbacks;
+    }
+};
+
+
+#endif
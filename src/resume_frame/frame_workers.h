@@ -0,0 +1,233 @@
+/*
+* Copyright (C) 2019 YaweiZhang <yawei.zhang@foxmail.com>.
+* All rights reserved
+* This file is part of the zframe, used MIT License.
+*/
+
+
+#ifndef FRAME_WORKERS_H_
+#define FRAME_WORKERS_H_
+
+#include "frame_def.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <new>
+#include <cstdlib>
+#ifdef WIN32
+#include <malloc.h>
+#endif // WIN32
+
+
+/*
+* tick worker threads of this process (not in shm, start again after resume).
+* thread safe hooks post id ranges in tick, Run splits them into chunks and
+* executes them on workers and the tick thread, then waits all workers done (tick barrier).
+* every worker owns a contiguous slice of chunks and steals from other slices when its own is drained.
+*/
+class FrameWorkers
+{
+public:
+    using Hook = void(*)(void* inst, u32 begin_id, u32 end_id, s64 now_ms);
+    static constexpr u32 kChunkSize = 1024; //ids of one task
+
+    static FrameWorkers& Instance()
+    {
+        static FrameWorkers workers;
+        return workers;
+    }
+
+    ~FrameWorkers() { Stop(); }
+
+    s32 Start(s32 threads)
+    {
+        Stop();
+        if (threads <= 0)
+        {
+            return 0;
+        }
+        exit_ = false;
+        slices_.reset(AllocSlices(threads + 1));
+        if (!slices_)
+        {
+            return -1;
+        }
+        for (s32 i = 0; i < threads; i++)
+        {
+            threads_.emplace_back(&FrameWorkers::Work, this, i + 1, generation_);
+        }
+        return 0;
+    }
+
+    void Stop()
+    {
+        if (threads_.empty())
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            exit_ = true;
+            generation_++;
+        }
+        wake_.notify_all();
+        for (auto& t : threads_)
+        {
+            t.join();
+        }
+        threads_.clear();
+        tasks_.clear();
+    }
+
+    bool Parallel() const { return !threads_.empty(); }
+    s32 Threads() const { return (s32)threads_.size(); }
+
+    //only called in tick thread
+    void Post(Hook hook, void* inst, u32 begin_id, u32 end_id, s64 now_ms)
+    {
+        for (u32 i = begin_id; i < end_id; i += kChunkSize)
+        {
+            tasks_.push_back({ hook, inst, i, end_id - i > kChunkSize ? i + kChunkSize : end_id, now_ms });
+        }
+    }
+
+    //execute posted tasks and wait all finish.
+    void Run()
+    {
+        if (tasks_.empty())
+        {
+            return;
+        }
+        if (threads_.empty())
+        {
+            for (const Task& t : tasks_)
+            {
+                t.hook_(t.inst_, t.begin_id_, t.end_id_, t.now_ms_);
+            }
+            tasks_.clear();
+            return;
+        }
+
+        u32 slice_count = (u32)threads_.size() + 1;
+        u32 task_count = (u32)tasks_.size();
+        for (u32 i = 0; i < slice_count; i++)
+        {
+            slices_[i].cursor_.store(task_count * i / slice_count, std::memory_order_relaxed);
+            slices_[i].end_ = task_count * (i + 1) / slice_count;
+        }
+        running_.store((u32)threads_.size(), std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> l(lock_);
+            generation_++;
+        }
+        wake_.notify_all();
+
+        Execute(0);
+        while (running_.load(std::memory_order_acquire) != 0)
+        {
+            std::this_thread::yield();
+        }
+        tasks_.clear();
+    }
+
+private:
+    struct Task
+    {
+        Hook hook_;
+        void* inst_;
+        u32 begin_id_;
+        u32 end_id_;
+        s64 now_ms_;
+    };
+
+    struct alignas(64) Slice
+    {
+        std::atomic<u32> cursor_;
+        u32 end_;
+    };
+    static_assert(std::is_trivially_destructible<Slice>::value, "slices are freed without destructor");
+
+    //plain new of an over-aligned type is not aligned before c++17.
+    struct SliceFree
+    {
+        void operator()(Slice* slices) const
+        {
+#ifdef WIN32
+            _aligned_free(slices);
+#else
+            free(slices);
+#endif // WIN32
+        }
+    };
+
+    static Slice* AllocSlices(s32 count)
+    {
+        void* addr = nullptr;
+#ifdef WIN32
+        addr = _aligned_malloc(sizeof(Slice) * count, alignof(Slice));
+#else
+        if (posix_memalign(&addr, alignof(Slice), sizeof(Slice) * count) != 0)
+        {
+            addr = nullptr;
+        }
+#endif // WIN32
+        if (addr == nullptr)
+        {
+            return nullptr;
+        }
+        Slice* slices = (Slice*)addr;
+        for (s32 i = 0; i < count; i++)
+        {
+            new (&slices[i]) Slice();
+        }
+        return slices;
+    }
+
+    void Execute(u32 self)
+    {
+        u32 slice_count = (u32)threads_.size() + 1;
+        for (u32 n = 0; n < slice_count; n++)
+        {
+            //own slice first, then steal others'.
+            Slice& slice = slices_[(self + n) % slice_count];
+            for (u32 id = slice.cursor_.fetch_add(1, std::memory_order_relaxed); id < slice.end_; id = slice.cursor_.fetch_add(1, std::memory_order_relaxed))
+            {
+                const Task& t = tasks_[id];
+                t.hook_(t.inst_, t.begin_id_, t.end_id_, t.now_ms_);
+            }
+        }
+    }
+
+    void Work(u32 self, u64 generation)
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> l(lock_);
+                wake_.wait(l, [&]() { return generation_ != generation; });
+                generation = generation_;
+                if (exit_)
+                {
+                    return;
+                }
+            }
+            Execute(self);
+            running_.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+private:
+    std::vector<std::thread> threads_;
+    std::vector<Task> tasks_;
+    std::unique_ptr<Slice[], SliceFree> slices_;
+    std::atomic<u32> running_{ 0 }; //workers not finish this generation
+    std::mutex lock_;
+    std::condition_variable wake_;
+    u64 generation_ = 0;
+    bool exit_ = false;
+};
+
+
+#endif
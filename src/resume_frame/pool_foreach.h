@@ -11,27 +11,119 @@
 
 #include "frame_def.h"
 #include "frame_option.h"
+#include "frame_workers.h"
 
 
 
 
 using PoolTick = s32(*)(void*, s64);
+//column-wise tick: stream the soa columns of chunk id range [begin_id, end_id) in one call.  
+using PoolColumnTick = s32(*)(zmem_pool&, zsoa_pool&, u32, u32, s64);
+//span tick: one call for chunk id range [begin_id, end_id), the hook loops the objects itself.  
+//distance is the prefetch_distance_ of the foreach.
+using PoolSpanTick = s32(*)(zmem_pool&, u32, u32, u32, s64);
+
+
+//visit used chunk ids in [begin_id, end_id), prefetch chunk i + distance when distance not 0.  
+template<class Fn>
+static inline void ForeachUsed(zmem_pool& pool, u32 begin_id, u32 end_id, u32 distance, Fn&& fn)
+{
+    if (pool.has_bitmap())
+    {
+        //word-at-a-time skip free chunks  
+        for (u32 i = pool.peek_used(begin_id, end_id); i < end_id; i = pool.peek_used(i + 1, end_id))
+        {
+            if (distance != 0 && i + distance < end_id)
+            {
+                ZBASE_PREFETCH(pool.ref(i + distance));
+            }
+            fn(i);
+        }
+        return;
+    }
+    for (u32 i = begin_id; i < end_id; i++)
+    {
+        if (distance != 0 && i + distance < end_id)
+        {
+            ZBASE_PREFETCH(pool.ref(i + distance));
+        }
+        if (!pool.ref(i)->used_)
+        {
+            continue;
+        }
+        fn(i);
+    }
+}
+
+//span tick of member Tick known at compile time: no indirect call per object, Tick can be inlined.  
+//a virtual Tick is still dispatched by vptr unless _Ty is final.   
+template<class _Ty, s32(_Ty::*Tick)(s64)>
+static inline s32 PoolMemberTick(zmem_pool& pool, u32 begin_id, u32 end_id, u32 distance, s64 now_ms)
+{
+    ForeachUsed(pool, begin_id, end_id, distance, [&pool, now_ms](u32 i)
+        {
+            (reinterpret_cast<_Ty*>(pool.fast(i))->*Tick)(now_ms);
+        });
+    return 0;
+}
 
 
 class ForeachInst
 {
 public:
     inline s32 hook(const zforeach_impl::subframe& sub, u32 begin_id, u32 end_id, s64 now_ms)
+    {
+        if (thread_safe_ && FrameWorkers::Instance().Parallel())
+        {
+            //run in workers before the end of window_foreach  
+            FrameWorkers::Instance().Post(&ForeachInst::Task, this, begin_id, end_id, now_ms);
+            return 0;
+        }
+        return run(begin_id, end_id, now_ms);
+    }
+
+    static void Task(void* inst, u32 begin_id, u32 end_id, s64 now_ms)
+    {
+        ((ForeachInst*)inst)->run(begin_id, end_id, now_ms);
+    }
+
+    inline s32 run(u32 begin_id, u32 end_id, s64 now_ms)
     {
         PoolSpace* space = SubSpace<PoolSpace, kPool>();
-        for (u32 i = begin_id; i < end_id; i++)
+        zmem_pool& pool = space->pools_[pool_id_];
+        end_id = std::min(end_id, (u32)pool.window_size());
+        if (column_tick_ != nullptr)
         {
-            tick_(space->pools_[pool_id_].fixed(i), now_ms);
+            if (begin_id < end_id)
+            {
+                column_tick_(pool, space->soas_[pool_id_], begin_id, end_id, now_ms);
+            }
+            return 0;
+        }
+        if (span_tick_ != nullptr)
+        {
+            if (begin_id < end_id)
+            {
+                span_tick_(pool, begin_id, end_id, prefetch_distance_, now_ms);
+            }
+            return 0;
         }
+        PoolTick tick = tick_;
+        ForeachUsed(pool, begin_id, end_id, prefetch_distance_, [&pool, tick, now_ms](u32 i)
+            {
+                tick(pool.fast(i), now_ms);
+            });
         return 0;
     }
     u32 pool_id_;
     PoolTick tick_;
+    PoolColumnTick column_tick_;
+    PoolSpanTick span_tick_;
+    u32 thread_safe_; //hook only touch its own object, can run in parallel  
+    u32 period_; //run in frames which frame % period_ == phase_  
+    u32 phase_;
+    u32 weight_; //ids of one step, used to stagger phases   
+    u32 prefetch_distance_; //pipelined: prefetch chunk i + distance when tick chunk i, 0 is off  
 };
 using PoolForeach = zforeach<ForeachInst>;
 
@@ -39,46 +131,260 @@ using PoolForeach = zforeach<ForeachInst>;
 
 
 
+/*
+* staggered scheduler: every foreach runs each period frames at its phase.
+* phase -1 picks the phase with the least ids per frame of the foreachs already added,
+* so long frame boundaries of different pools not land on the same frame.
+* base_frame_len is the frame length of window_foreach, the foreach steps every base_frame_len * period.
+*/
 class PoolForeachs
 {
 public:
+    static constexpr u32 kMaxPeriod = 64;
+    static constexpr u32 kCostBuckets = 24; //bucket i: cost in [2^(i-1), 2^i) us, bucket 0 less than 1us  
 
-    inline s32 add(u32 pool_id, u32 begin_id, u32 end_id, u32 base_frame_len, u32 long_frame_len, PoolTick hook)
+    inline s32 add(u32 pool_id, u32 begin_id, u32 end_id, u32 base_frame_len, u32 long_frame_len, PoolTick hook, bool thread_safe = false, u32 period = 1, s32 phase = -1)
     {
-        PoolForeach f;
-        f.foreach_inst_.pool_id_ = pool_id;
-        f.foreach_inst_.tick_ = hook;
-        foreachs_.push_back(f);
-        s32 ret = foreachs_.back().init(0, begin_id, end_id, base_frame_len, long_frame_len);
-        return ret;
+        ForeachInst inst;
+        memset(&inst, 0, sizeof(inst));
+        inst.pool_id_ = pool_id;
+        inst.tick_ = hook;
+        inst.thread_safe_ = thread_safe;
+        return push(inst, begin_id, end_id, base_frame_len, long_frame_len, period, phase);
+    }
+
+    inline s32 add(u32 pool_id, u32 begin_id, u32 end_id, u32 base_frame_len, u32 long_frame_len, PoolColumnTick hook, bool thread_safe = false, u32 period = 1, s32 phase = -1)
+    {
+        ForeachInst inst;
+        memset(&inst, 0, sizeof(inst));
+        inst.pool_id_ = pool_id;
+        inst.column_tick_ = hook;
+        inst.thread_safe_ = thread_safe;
+        return push(inst, begin_id, end_id, base_frame_len, long_frame_len, period, phase);
+    }
+
+    inline s32 add(u32 pool_id, u32 begin_id, u32 end_id, u32 base_frame_len, u32 long_frame_len, PoolSpanTick hook, bool thread_safe = false, u32 period = 1, s32 phase = -1)
+    {
+        ForeachInst inst;
+        memset(&inst, 0, sizeof(inst));
+        inst.pool_id_ = pool_id;
+        inst.span_tick_ = hook;
+        inst.thread_safe_ = thread_safe;
+        return push(inst, begin_id, end_id, base_frame_len, long_frame_len, period, phase);
+    }
+
+    //foreachs_.add<Unit, &Unit::Tick>(...)  
+    template<class _Ty, s32(_Ty::*Tick)(s64)>
+    inline s32 add(u32 pool_id, u32 begin_id, u32 end_id, u32 base_frame_len, u32 long_frame_len, bool thread_safe = false, u32 period = 1, s32 phase = -1)
+    {
+        return add(pool_id, begin_id, end_id, base_frame_len, long_frame_len, &PoolMemberTick<_Ty, Tick>, thread_safe, period, phase);
     }
 
     inline s32 resume(u32 pool_id, u32 begin_id, u32 end_id, u32 base_frame_len, u32 long_frame_len, PoolTick hook)
     {
+        rebind();
+        s32 ret = -1;
         for (u32 i = 0; i < foreachs_.size(); i++)
         {
             PoolForeach& pf = foreachs_[i];
-            pf.resume();
             if (pf.foreach_inst_.pool_id_ == pool_id)
             {
                 pf.foreach_inst_.tick_ = hook;
-                return 0;
+                ret = 0;
             }
         }
-        return -1;
+        return ret;
+    }
+
+    inline s32 resume(u32 pool_id, u32 begin_id, u32 end_id, u32 base_frame_len, u32 long_frame_len, PoolColumnTick hook)
+    {
+        rebind();
+        s32 ret = -1;
+        for (u32 i = 0; i < foreachs_.size(); i++)
+        {
+            PoolForeach& pf = foreachs_[i];
+            if (pf.foreach_inst_.pool_id_ == pool_id)
+            {
+                pf.foreach_inst_.column_tick_ = hook;
+                ret = 0;
+            }
+        }
+        return ret;
+    }
+
+    inline s32 resume(u32 pool_id, u32 begin_id, u32 end_id, u32 base_frame_len, u32 long_frame_len, PoolSpanTick hook)
+    {
+        rebind();
+        s32 ret = -1;
+        for (u32 i = 0; i < foreachs_.size(); i++)
+        {
+            PoolForeach& pf = foreachs_[i];
+            if (pf.foreach_inst_.pool_id_ == pool_id)
+            {
+                pf.foreach_inst_.span_tick_ = hook;
+                ret = 0;
+            }
+        }
+        return ret;
+    }
+
+    template<class _Ty, s32(_Ty::*Tick)(s64)>
+    inline s32 resume(u32 pool_id, u32 begin_id, u32 end_id, u32 base_frame_len, u32 long_frame_len)
+    {
+        return resume(pool_id, begin_id, end_id, base_frame_len, long_frame_len, &PoolMemberTick<_Ty, Tick>);
+    }
+
+    //adaptive slicing of the foreach of pool_id, 0 is fixed sub steps.   
+    inline s32 budget(u32 pool_id, u32 budget_us)
+    {
+        PoolForeach* pf = find(pool_id);
+        if (pf == nullptr)
+        {
+            return -1;
+        }
+        pf->set_budget(budget_us);
+        return 0;
+    }
+
+    //pipelined iteration of the foreachs of pool_id, 0 is off.    
+    inline s32 prefetch(u32 pool_id, u32 distance)
+    {
+        s32 ret = -1;
+        for (PoolForeach& f : foreachs_)
+        {
+            if (f.foreach_inst_.pool_id_ == pool_id)
+            {
+                f.foreach_inst_.prefetch_distance_ = distance;
+                ret = 0;
+            }
+        }
+        return ret;
+    }
+
+    inline PoolForeach* find(u32 pool_id)
+    {
+        for (PoolForeach& f : foreachs_)
+        {
+            if (f.foreach_inst_.pool_id_ == pool_id)
+            {
+                return &f;
+            }
+        }
+        return nullptr;
     }
 
     inline s32 window_foreach(s64 now_ms)
     {
+        zclock clock;
+        clock.start();
         for (PoolForeach& f : foreachs_)
         {
+            if (frame_ % f.foreach_inst_.period_ != f.foreach_inst_.phase_)
+            {
+                continue;
+            }
             f.window_foreach(f.subframe_.soft_begin_, f.subframe_.soft_end_, now_ms);
         }
+        //tick barrier: thread safe hooks posted above are all done after it.  
+        FrameWorkers::Instance().Run();
+        clock.save();
+        frame_++;
+
+        u64 cost_us = (u64)clock.duration_ns() / 1000;
+        u32 bucket = 0;
+        while (cost_us > 0 && bucket + 1 < kCostBuckets)
+        {
+            cost_us >>= 1;
+            bucket++;
+        }
+        cost_hist_[bucket]++;
         return 0;
     }
 
+    inline u64 frame() const { return frame_; }
+    inline const u64* cost_histogram() const { return cost_hist_; }
+
+    //log per frame cost histogram since last report. 
+    inline void report(const char* desc, bool reset = true)
+    {
+        FNLog::LogStream ls(std::move(LogInfo()));
+        ls << desc << " foreachs:" << foreachs_.size() << ", frames:" << frame_ << ", frame cost:";
+        for (u32 i = 0; i < kCostBuckets; i++)
+        {
+            if (cost_hist_[i] == 0)
+            {
+                continue;
+            }
+            ls << " [" << (i == 0 ? 0 : 1ULL << (i - 1)) << "us," << (1ULL << i) << "us):" << cost_hist_[i];
+        }
+        if (reset)
+        {
+            memset(cost_hist_, 0, sizeof(cost_hist_));
+        }
+    }
+
 private:
+    inline s32 push(ForeachInst& inst, u32 begin_id, u32 end_id, u32 base_frame_len, u32 long_frame_len, u32 period, s32 phase)
+    {
+        if (period == 0 || period > kMaxPeriod || phase >= (s32)period)
+        {
+            return -10;
+        }
+        PoolForeach f;
+        s32 ret = f.init(0, begin_id, end_id, base_frame_len * period, long_frame_len);
+        if (ret != 0)
+        {
+            return ret;
+        }
+        inst.period_ = period;
+        inst.weight_ = (end_id - begin_id + f.subframe_.sub_steps_ - 1) / f.subframe_.sub_steps_;
+        inst.phase_ = phase < 0 ? least_phase(period) : (u32)phase;
+        f.foreach_inst_ = inst;
+        foreachs_.push_back(f);
+        rebind();
+        return 0;
+    }
+
+    //the phase whose frames have least max ids.   
+    inline u32 least_phase(u32 period)
+    {
+        u64 load[kMaxPeriod] = { 0 };
+        for (const PoolForeach& f : foreachs_)
+        {
+            for (u32 frame = f.foreach_inst_.phase_; frame < kMaxPeriod; frame += f.foreach_inst_.period_)
+            {
+                load[frame] += f.foreach_inst_.weight_;
+            }
+        }
+        u32 best_phase = 0;
+        u64 best_load = ~0ULL;
+        for (u32 phase = 0; phase < period; phase++)
+        {
+            u64 max_load = 0;
+            for (u32 frame = phase; frame < kMaxPeriod; frame += period)
+            {
+                max_load = std::max(max_load, load[frame]);
+            }
+            if (max_load < best_load)
+            {
+                best_load = max_load;
+                best_phase = phase;
+            }
+        }
+        return best_phase;
+    }
+
+    //push_back maybe moved the foreachs.  
+    inline void rebind()
+    {
+        for (PoolForeach& f : foreachs_)
+        {
+            f.resume();
+        }
+    }
     shm_vector<PoolForeach> foreachs_;
+    u64 frame_ = 0;
+    u64 cost_hist_[kCostBuckets] = { 0 };
 };
 
 #endif
\ No newline at end of file
@@ -43,7 +43,8 @@ public:
 
     PoolSpace* space() const { return space_; }
 
-    s32 Add(s32 pool_id, s32 obj_size, u64 obj_vptr, s32 obj_count, const std::string& name)
+    s32 Add(s32 pool_id, s32 obj_size, u64 obj_vptr, s32 obj_count, const std::string& name, bool with_bitmap = false, 
+        std::initializer_list<s32> columns = {})
     {
         if (pool_id < 0 || pool_id >= kLimitObjectCount)
         {
@@ -54,6 +55,10 @@ public:
         {
             return -2;
         }
+        if (columns.size() > (size_t)zsoa_pool::MAX_COLUMNS)
+        {
+            return -4;
+        }
 
         PoolConf& conf = space_->conf_[pool_id];
         if (conf.obj_count_ > 0)
@@ -72,7 +77,14 @@ public:
         conf.name_id_ = name_id;
         conf.vptr_ = obj_vptr;
         conf.obj_count_ = obj_count;
-        conf.space_size_ = zmem_pool::calculate_space_size(obj_size, obj_count);
+        conf.with_bitmap_ = with_bitmap;
+        conf.column_count_ = 0;
+        for (s32 column_size : columns)
+        {
+            conf.column_size_[conf.column_count_++] = column_size;
+        }
+        conf.space_size_ = zmem_pool::calculate_space_size(obj_size, obj_count, with_bitmap);
+        conf.space_size_ += zsoa_pool::calculate_space_size(obj_count, conf.column_size_, conf.column_count_);
         if (space_->max_used_id_ < pool_id)
         {
             space_->max_used_id_ = pool_id;
@@ -82,7 +94,31 @@ public:
 
 
     template<class _Ty>
-    s32 Add(s32 pool_id, s32 obj_count, const std::string& specify_name = "")
+    s32 Add(s32 pool_id, s32 obj_count, const std::string& specify_name = "", bool with_bitmap = false)
+    {
+        if (pool_id < 0 || pool_id >= kLimitObjectCount)
+        {
+            //invalid param
+            return -1;
+        }
+        std::string name = specify_name;
+        if (name.empty())
+        {
+            name = zsymbols::readable_class_name<_Ty>();
+        }
+        s32 obj_size = (s32)sizeof(_Ty);
+        u64 vptr = zmem_pool::get_vptr<_Ty>();
+        s32 ret = Add(pool_id, obj_size, vptr, obj_count, name, with_bitmap);
+        if (ret != 0)
+        {
+            return ret;
+        }
+        return 0;
+    }
+
+    //soa pool: the hot members listed by column sizes are stored in separate columns, addressed by chunk id.  
+    template<class _Ty>
+    s32 Add(s32 pool_id, s32 obj_count, std::initializer_list<s32> columns, const std::string& specify_name = "", bool with_bitmap = false)
     {
         if (pool_id < 0 || pool_id >= kLimitObjectCount)
         {
@@ -96,7 +132,7 @@ public:
         }
         s32 obj_size = (s32)sizeof(_Ty);
         u64 vptr = zmem_pool::get_vptr<_Ty>();
-        s32 ret = Add(pool_id, obj_size, vptr, obj_count, name);
+        s32 ret = Add(pool_id, obj_size, vptr, obj_count, name, with_bitmap, columns);
         if (ret != 0)
         {
             return ret;
@@ -139,6 +175,42 @@ public:
         return 0;
     }
 
+    //old pools can migrate to this space: same obj size and name, obj count not shrink. new pool id is allowed.   
+    s32 Compatible(const PoolSpace* old) const
+    {
+        if (old == nullptr || space_ == nullptr)
+        {
+            return -1;
+        }
+        for (s32 i = 0; i <= old->max_used_id_; i++)
+        {
+            const PoolConf& old_conf = old->conf_[i];
+            const PoolConf& conf = space_->conf_[i];
+            if (old_conf.obj_count_ == 0)
+            {
+                continue;
+            }
+            if (conf.obj_size_ != old_conf.obj_size_)
+            {
+                return -2;
+            }
+            if (conf.obj_count_ < old_conf.obj_count_)
+            {
+                return -3;
+            }
+            if (strcmp(&space_->names_[conf.name_id_], &old->names_[old_conf.name_id_]) != 0)
+            {
+                return -4;
+            }
+            if (conf.column_count_ != old_conf.column_count_ 
+                || memcmp(conf.column_size_, old_conf.column_size_, sizeof(s32) * conf.column_count_) != 0)
+            {
+                return -5;
+            }
+        }
+        return 0;
+    }
+
 };
 
 
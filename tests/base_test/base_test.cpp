@@ -29,6 +29,7 @@ public:
         LogDebug() << "Unit:" <<(void*)this <<":" << uid_ << " ticked:" << seq_ << ", now_ms:" << now_ms;
         return 0;
     }
+    u32 seq() const { return seq_; }
 
 private:
     u32 uid_;
@@ -36,9 +37,73 @@ private:
 };
 
 
-s32 UnitTick(void* unit, s64 now_ms)
+//fat pool ticked by workers  
+struct Crowd
 {
-    ((Unit*)unit)->Tick(now_ms);
+    u64 ticks_;
+};
+constexpr static s32 kCrowdCount = 100000;
+
+s32 CrowdTick(void* crowd, s64 now_ms)
+{
+    ((Crowd*)crowd)->ticks_++;
+    return 0;
+}
+
+//timer callback ids  
+enum TestTimer : u32
+{
+    kTimerRepeat = 1,
+    kTimerCanceled,
+};
+
+s32 OnRepeatTimer(u64 timer_id, u64 userdata, s64 now_ms)
+{
+    LogDebug() << "repeat timer:" << timer_id << " fired:" << userdata << ", now_ms:" << now_ms;
+    FrameTimer::Add(now_ms + 500, kTimerRepeat, userdata + 1);
+    return 0;
+}
+
+s32 OnCanceledTimer(u64 timer_id, u64 userdata, s64 now_ms)
+{
+    LogError() << "canceled timer:" << timer_id << " fired.";
+    return 0;
+}
+
+//pushed by a producer thread, seq is continuous in one producer.
+//producer is the cmd_epoch_ of the frame: it grows in every Start/Resume, so a restarted process never reuses it.
+struct TestCommand
+{
+    u32 producer_;
+    u32 reserve_;
+    u64 seq_;
+};
+enum TestCommandType : u32
+{
+    kCommandTest = 1,
+};
+
+//per tick scratch buffers in their own arena, dropped at once every 100 ticks  
+constexpr static u16 kColorScratch = MEM_COLOR_MAX;
+constexpr static u32 kArenaScratch = 1;
+
+static FNLog::LogStream ArenaLog()
+{
+    return LOG_STREAM_ORIGIN(FNLog::GetDefaultLogger(), 0, FNLog::PRIORITY_INFO, 0, 0, FNLog::LOG_PREFIX_DEFAULT);
+}
+
+
+//soa columns of unit: 0 pos, 1 speed  
+s32 UnitMoveTick(zmem_pool& pool, zsoa_pool& soa, u32 begin_id, u32 end_id, s64 now_ms)
+{
+    f32* pos = soa.column<f32>(0);
+    const f32* speed = soa.column<f32>(1);
+    //walks the bitmap when the pool has one, else checks the chunk heads.
+    ForeachUsed(pool, begin_id, end_id, 0, [pos, speed, now_ms](u32 i)
+    {
+        pos[i] += speed[i];
+        LogDebug() << "Unit:" << i << " moved pos:" << pos[i] << ", now_ms:" << now_ms;
+    });
     return 0;
 }
 
@@ -59,25 +124,57 @@ public:
 
         PoolHelper helper;
         helper.Attach(conf.pool_conf_, true);
-        ret = helper.Add<Unit>(0, 2);
+        bool grow = options.find("grow") != std::string::npos;
+        ret = helper.Add<Unit>(0, grow ? 4 : 2, "", true);
         if (ret != 0)
         {
             return ret;
         }
+        if (grow)
+        {
+            ret = helper.Add(1, 16, 0, 10, "grow");
+            if (ret != 0)
+            {
+                return ret;
+            }
+        }
+        if (options.find("parallel") != std::string::npos || options.find("budget") != std::string::npos || options.find("stagger") != std::string::npos)
+        {
+            ret = helper.Add<Crowd>(3, kCrowdCount, "", true);
+            if (ret != 0)
+            {
+                return ret;
+            }
+        }
+        if (options.find("soa") != std::string::npos)
+        {
+            ret = helper.Add<Unit>(2, 4, { sizeof(f32), sizeof(f32) }, "soa_unit", true);
+            if (ret != 0)
+            {
+                return ret;
+            }
+        }
 
         conf.space_conf_.use_heap_ = options.find("heap") != std::string::npos;
+        conf.space_conf_.use_huge_page_ = options.find("huge") != std::string::npos;
+        conf.boot_conf_.prefault_ = options.find("prefault") != std::string::npos;
+        conf.boot_conf_.numa_node_ = options.find("numa") != std::string::npos ? 0 : -1;
+        conf.boot_conf_.migrate_ = options.find("migrate") != std::string::npos;
+        conf.boot_conf_.shadow_key_ = options.find("shadow") != std::string::npos ? conf.space_conf_.shm_key_ + 1 : 0;
+        conf.boot_conf_.tick_threads_ = options.find("parallel") != std::string::npos ? 4 : 0;
+        conf.boot_conf_.io_uring_ = options.find("uring") != std::string::npos;
+        conf.boot_conf_.io_threads_ = options.find("uring") != std::string::npos || options.find("iothreads") != std::string::npos ? 2 : 0;
+        conf.boot_conf_.slab_threshold_ = options.find("noslab") != std::string::npos ? 0 : zmalloc::SLAB_MAX_REQUEST;
         conf.space_conf_.subs_[ShmSpace::kMainFrame].size_ = SPACE_ALIGN(sizeof(TestServer));
         conf.space_conf_.subs_[ShmSpace::kPool].size_ = kPoolSpaceHeadSize + helper.TotalSpaceSize();
         conf.space_conf_.subs_[ShmSpace::kBuddy].size_ = SPACE_ALIGN(zbuddy::zbuddy_size(kHeapSpaceOrder));
-        conf.space_conf_.subs_[ShmSpace::kMalloc].size_ = SPACE_ALIGN(zmalloc::zmalloc_size());
+        conf.space_conf_.subs_[ShmSpace::kMalloc].size_ = SPACE_ALIGN(sizeof(zmalloc_arenas));
         conf.space_conf_.subs_[ShmSpace::kHeap].size_ = SPACE_ALIGN(zbuddy_shift_size(kHeapSpaceOrder + kPageOrder));
+        conf.space_conf_.subs_[ShmSpace::kTimer].size_ = SPACE_ALIGN(kTimerSpaceSize);
+        conf.space_conf_.subs_[ShmSpace::kCommand].size_ = SPACE_ALIGN(kCommandSpaceSize);
+        conf.space_conf_.subs_[ShmSpace::kThreadCache].size_ = SPACE_ALIGN(sizeof(ztcache));
 
-        conf.space_conf_.whole_.size_ = SPACE_ALIGN(sizeof(conf.space_conf_));
-        for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
-        {
-            conf.space_conf_.subs_[i].offset_ = conf.space_conf_.whole_.size_;
-            conf.space_conf_.whole_.size_ += conf.space_conf_.subs_[i].size_;
-        }
+        BaseFrame::LayoutSpace(conf.space_conf_);
         return 0;
     }
     s32 Start()
@@ -91,9 +188,63 @@ public:
         zmalloc::instance().free_memory(zmalloc::instance().alloc_memory(1000));
         zmalloc::instance().check_panic();
         LogInfo() << "MyServer Start";
-        foreachs_.add(0, 0, 2, 10, 1000, UnitTick);
+        tick_count_ = 0;
+        cmd_epoch_ = 1;
+        cmd_producer_ = 0;
+        cmd_last_seq_ = 0;
+        cmd_count_ = 0;
+        cmd_gaps_ = 0;
+        io_bytes_ = 0;
+        status_writing_ = 0;
+        scratch_bytes_ = 0;
+        if (scratch_arena_ && ztcache::instance().bind_color(kColorScratch, kArenaScratch) != 0)
+        {
+            LogError() << "bind scratch color error";
+            return -3;
+        }
+        FrameCommands::Register(kCommandTest, OnTestCommand);
+        FrameTimer::Register(kTimerRepeat, OnRepeatTimer);
+        FrameTimer::Register(kTimerCanceled, OnCanceledTimer);
+        FrameTimer::Add(zclock::now_ms() + 500, kTimerRepeat, 1);
+        ret = FrameTimer::Cancel(FrameTimer::Add(zclock::now_ms() + 100, kTimerCanceled, 0));
+        if (ret != 0)
+        {
+            LogError() << "cancel timer error";
+            return -2;
+        }
+        foreachs_.add<Unit, &Unit::Tick>(0, 0, 2, 10, 1000);
         SubSpace<PoolSpace, kPool>()->pools_[0].create<Unit>();
         SubSpace<PoolSpace, kPool>()->pools_[0].create<Unit>();
+        zsoa_pool& soa = SubSpace<PoolSpace, kPool>()->soas_[2];
+        if (soa.has_columns())
+        {
+            zmem_pool& pool = SubSpace<PoolSpace, kPool>()->pools_[2];
+            foreachs_.add(2, 0, 4, 10, 1000, UnitMoveTick);
+            for (s32 i = 0; i < 2; i++)
+            {
+                s32 chunk_id = pool.chunk_id(pool.create<Unit>());
+                soa.at<f32>(0, chunk_id) = 0.0f;
+                soa.at<f32>(1, chunk_id) = 1.0f + chunk_id;
+            }
+        }
+        AddStages();
+        zmem_pool& crowd = SubSpace<PoolSpace, kPool>()->pools_[3];
+        if (crowd.max_size() > 0)
+        {
+            std::unique_ptr<s32[]> ids(new s32[kCrowdCount]);
+            crowd.create_n<Crowd>(kCrowdCount, ids.get());
+            if (crowd_stagger_)
+            {
+                //two halves every 2nd frame, auto placed on different phases  
+                foreachs_.add(3, 0, kCrowdCount / 2, 10, 100, CrowdTick, true, 2);
+                foreachs_.add(3, kCrowdCount / 2, kCrowdCount, 10, 100, CrowdTick, true, 2);
+            }
+            else
+            {
+                foreachs_.add(3, 0, kCrowdCount, 10, 100, CrowdTick, true);
+                foreachs_.budget(3, crowd_budget_us_);
+            }
+        }
 
         return 0;
     }
@@ -108,23 +259,239 @@ public:
         zmalloc::instance().free_memory(zmalloc::instance().alloc_memory(1000));
         zmalloc::instance().check_panic();
         LogInfo() << "MyServer Resume";
-        foreachs_.resume(0, 0, 2, 10, 1000, UnitTick);
+        FrameTimer::Register(kTimerRepeat, OnRepeatTimer);
+        FrameTimer::Register(kTimerCanceled, OnCanceledTimer);
+        FrameCommands::Register(kCommandTest, OnTestCommand);
+        cmd_epoch_++; //slots dropped by recover belong to the old epoch
+        status_writing_ = 0; //the write of old process is lost  
+        foreachs_.resume<Unit, &Unit::Tick>(0, 0, 2, 10, 1000);
+        if (SubSpace<PoolSpace, kPool>()->soas_[2].has_columns())
+        {
+            foreachs_.resume(2, 0, 4, 10, 1000, UnitMoveTick);
+        }
+        if (SubSpace<PoolSpace, kPool>()->pools_[3].max_size() > 0)
+        {
+            foreachs_.resume(3, 0, kCrowdCount, 10, 100, CrowdTick);
+        }
+        AddStages();
+        return 0;
+    }
+
+    //foreach writes all pools (and uses workers itself), then the two stats stages only read and run in one wave.  
+    void AddStages()
+    {
+        stages_.add("foreach", StageForeach, this, {}, { 0, 2, 3 }, false);
+        stages_.add("crowd_stats", StageCrowdStats, this, { 3 }, {});
+        stages_.add("unit_stats", StageUnitStats, this, { 0 }, {});
+    }
+
+    static s32 StageForeach(void* frame, s64 now_ms)
+    {
+        return ((TestServer*)frame)->foreachs_.window_foreach(now_ms);
+    }
+
+    static s32 StageCrowdStats(void* frame, s64 now_ms)
+    {
+        TestServer* server = (TestServer*)frame;
+        zmem_pool& crowd = SubSpace<PoolSpace, kPool>()->pools_[3];
+        if (crowd.max_size() == 0 || server->tick_count_ % 100 != 0)
+        {
+            return 0;
+        }
+        server->crowd_min_ticks_ = ~0ULL;
+        server->crowd_max_ticks_ = 0;
+        for (s32 i = 0; i < crowd.window_size(); i++)
+        {
+            u64 ticks = crowd.cast<Crowd>(i)->ticks_;
+            server->crowd_min_ticks_ = std::min(server->crowd_min_ticks_, ticks);
+            server->crowd_max_ticks_ = std::max(server->crowd_max_ticks_, ticks);
+        }
+        return 0;
+    }
+
+    static s32 StageUnitStats(void* frame, s64 now_ms)
+    {
+        TestServer* server = (TestServer*)frame;
+        server->unit_count_ = SubSpace<PoolSpace, kPool>()->pools_[0].size();
         return 0;
     }
+
+    static s32 OnTestCommand(u32 type, const char* data, u32 len, s64 now_ms)
+    {
+        TestServer* server = SubSpace<TestServer, kMainFrame>();
+        const TestCommand* cmd = (const TestCommand*)data;
+        if (len != sizeof(TestCommand))
+        {
+            LogError() << "command len:" << len;
+            return -1;
+        }
+        if (cmd->producer_ != server->cmd_producer_)
+        {
+            LogInfo() << "command producer:" << server->cmd_producer_ << " -> " << cmd->producer_ << ", last seq:" << server->cmd_last_seq_ << ", first seq:" << cmd->seq_;
+            server->cmd_producer_ = cmd->producer_;
+        }
+        else if (cmd->seq_ != server->cmd_last_seq_ + 1)
+        {
+            LogError() << "command producer:" << cmd->producer_ << " seq:" << cmd->seq_ << " after:" << server->cmd_last_seq_;
+            server->cmd_gaps_++;
+        }
+        server->cmd_last_seq_ = cmd->seq_;
+        server->cmd_count_++;
+        return 0;
+    }
+
     s32 Tick(s64 now_ms)
     {
-        foreachs_.window_foreach(now_ms);
+        tick_count_++;
+        stages_.run(now_ms);
+        if (scratch_arena_)
+        {
+            ScratchTick();
+        }
+        if (tick_count_ % 100 != 0)
+        {
+            return 0;
+        }
+        stages_.report("tick");
+        zmem_pool& crowd = SubSpace<PoolSpace, kPool>()->pools_[3];
+        if (crowd.max_size() > 0)
+        {
+            PoolForeach* pf = foreachs_.find(3);
+            foreachs_.report("tick");
+            LogInfo() << "crowd:" << crowd.size() << " ticks:[" << crowd_min_ticks_ << ", " << crowd_max_ticks_ << "], workers:" << FrameWorkers::Instance().Threads()
+                << ", budget:" << pf->subframe_.budget_us_ << "us, cost:" << pf->subframe_.cost_ns_ << "ns, overrun:" << pf->overrun_count() << ", carry over:" << pf->carry_over();
+        }
+        LogInfo() << "units:" << unit_count_ << ", stages:" << stages_.count() << ", waves:" << stages_.waves();
+        LogInfo() << "commands:" << cmd_count_ << ", last seq:" << cmd_last_seq_ << ", gaps:" << cmd_gaps_ << ", in ring:" << FrameCommands::Ring().size() << ", full:" << FrameCommands::Ring().full_count();
+        if (status_fd_ >= 0 && !status_writing_)
+        {
+            s32 len = snprintf(status_line_, sizeof(status_line_), "tick:%llu now:%lld commands:%llu\n", (unsigned long long)tick_count_, (long long)now_ms, (unsigned long long)cmd_count_);
+            status_writing_ = FrameIO::Instance().Write(status_fd_, status_line_, (u32)len, -1, OnStatusWritten, 0) == 0;
+        }
+        LogInfo() << "io backend:" << (u32)FrameIO::Instance().Backend() << ", status bytes:" << io_bytes_;
         return 0;
     }
 
+    //scratch buffers are never freed one by one, the whole arena is released.  
+    void ScratchTick()
+    {
+        for (u32 i = 0; i < 64; i++)
+        {
+            u64 bytes = 32 + (tick_count_ * 64 + i) * 97 % 4000;
+            char* buf = (char*)ztcache::alloc_global<kColorScratch>(bytes);
+            if (buf == nullptr)
+            {
+                LogError() << "scratch alloc error. bytes:" << bytes;
+                return;
+            }
+            memset(buf, (s32)i, bytes);
+            scratch_bytes_ += bytes;
+        }
+        if (tick_count_ % 100 != 0)
+        {
+            return;
+        }
+        zmalloc_arenas& arenas = zmalloc_arenas::instance();
+        ztcache::instance().lock();
+        arenas.debug_state_log(ArenaLog);
+        s64 released = arenas.release_arena(kArenaScratch);
+        arenas.check_panic();
+        ztcache::instance().unlock();
+        LogInfo() << "scratch arena requested:" << scratch_bytes_ << ", released:" << released << ", live:" << arenas.live_count(kColorScratch);
+        scratch_bytes_ = 0;
+    }
+
+    //io completion, in tick thread  
+    static void OnStatusWritten(u64 userdata, s64 result)
+    {
+        TestServer* server = SubSpace<TestServer, kMainFrame>();
+        if (result < 0)
+        {
+            LogError() << "write status error:" << result;
+        }
+        else
+        {
+            server->io_bytes_ += (u64)result;
+        }
+        server->status_writing_ = 0;
+    }
+
 public:
     PoolForeachs foreachs_;
+    u64 tick_count_;
+    u64 crowd_min_ticks_;
+    u64 crowd_max_ticks_;
+    s32 unit_count_;
+    u32 cmd_epoch_;
+    u32 cmd_producer_;
+    u64 cmd_last_seq_;
+    u64 cmd_count_;
+    u64 cmd_gaps_;
+    u64 io_bytes_;
+    u32 status_writing_;
+    char status_line_[128];
+    u64 scratch_bytes_;
+    static u32 crowd_budget_us_;
+    static bool crowd_stagger_;
+    static bool scratch_arena_;
+    static s32 status_fd_; //process local  
 };
 
 
 
+u32 TestServer::crowd_budget_us_ = 0;
+bool TestServer::crowd_stagger_ = false;
+bool TestServer::scratch_arena_ = false;
+s32 TestServer::status_fd_ = -1;
+
+//other process reads the live frame  
+s32 observe_server()
+{
+    PoolView<Unit> units(0);
+    PoolView<Crowd> crowd(3);
+    for (s32 round = 0; round < 10; round++)
+    {
+        u64 unit_seq = 0;
+        s32 unit_count = 0;
+        u64 min_ticks = ~0ULL;
+        u64 max_ticks = 0;
+        s32 ret = FrameEpoch::Read([&]()
+            {
+                unit_seq = 0;
+                unit_count = units.size();
+                units.foreach([&](s32 id, const Unit& unit) { unit_seq += unit.seq(); });
+                min_ticks = ~0ULL;
+                max_ticks = 0;
+                if (crowd.valid())
+                {
+                    crowd.foreach([&](s32 id, const Crowd& c)
+                        {
+                            min_ticks = std::min(min_ticks, c.ticks_);
+                            max_ticks = std::max(max_ticks, c.ticks_);
+                        });
+                }
+            }, 10000);
+        if (ret != 0)
+        {
+            LogError() << "observe round:" << round << " no stable frame.";
+            return ret;
+        }
+        LogInfo() << "observe round:" << round << " epoch:" << FrameEpoch::Epoch().load() << " units:" << unit_count << " ticked:" << unit_seq
+            << (crowd.valid() ? " crowd ticks:[" : "") << (crowd.valid() ? std::to_string(min_ticks) + ", " + std::to_string(max_ticks) + "]" : "");
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return 0;
+}
+
 s32 boot_server(const std::string& option)
 {
+    TestServer::crowd_budget_us_ = option.find("budget") != std::string::npos ? 200 : 0;
+    TestServer::crowd_stagger_ = option.find("stagger") != std::string::npos;
+    TestServer::scratch_arena_ = option.find("arena") != std::string::npos;
+    if ((option.find("uring") != std::string::npos || option.find("iothreads") != std::string::npos) && TestServer::status_fd_ < 0)
+    {
+        TestServer::status_fd_ = open("./frame_status.log", O_WRONLY | O_CREAT | O_APPEND, 0644);
+    }
 
     if (option.find("start") != std::string::npos)
     {
@@ -136,6 +503,18 @@ s32 boot_server(const std::string& option)
         ASSERT_TEST(FrameBoot<TestServer>::ResumeShm(option) == 0);
     }
 
+    if (option.find("restore") != std::string::npos)
+    {
+        ASSERT_TEST(FrameBoot<TestServer>::RestoreShm(option, "./frame.snapshot") == 0);
+    }
+
+    if (option.find("observe") != std::string::npos)
+    {
+        ASSERT_TEST(FrameBoot<TestServer>::AttachReadOnly(option) == 0);
+        ASSERT_TEST(observe_server() == 0);
+        ASSERT_TEST(FrameBoot<TestServer>::DetachReadOnly() == 0);
+    }
+
     if (option.find("exit") != std::string::npos)
     {
         ASSERT_TEST(FrameBoot<TestServer>::ExitShm(option) == 0);
@@ -159,7 +538,7 @@ int main(int argc, char *argv[])
     std::string option;
     if (argc <= 1)
     {
-        LogInfo() << "used [start stop resume hold] +- [heap] to start server test";
+        LogInfo() << "used [start stop resume hold] +- [heap] [huge] [prefault] [numa] [migrate] [grow] [soa] [parallel] [budget] [stagger] [arena] [noslab] [observe] [cmd] [uring] [iothreads] [shadow] [snapshot] [incr] [compact] [restore] to start server test";
         return 0;
     }
     for (int i = 1; i < argc; i++)
@@ -171,13 +550,62 @@ int main(int argc, char *argv[])
 
     ASSERT_TEST(boot_server(option) == 0);
 
-    if (option.find("del") == std::string::npos)
+    //io thread feeds the frame  
+    std::atomic<bool> cmd_exit(false);
+    std::thread cmd_producer;
+    if (option.find("cmd") != std::string::npos && option.find("del") == std::string::npos && option.find("observe") == std::string::npos)
+    {
+        u32 epoch = SubSpace<TestServer, kMainFrame>()->cmd_epoch_;
+        cmd_producer = std::thread([&cmd_exit, epoch]()
+            {
+                TestCommand cmd;
+                memset(&cmd, 0, sizeof(cmd));
+                cmd.producer_ = epoch;
+                while (!cmd_exit.load())
+                {
+                    cmd.seq_++;
+                    while (FrameCommands::Push(kCommandTest, cmd) != 0 && !cmd_exit.load())
+                    {
+                        std::this_thread::yield();
+                    }
+                    if (cmd.seq_ % 64 == 0)
+                    {
+                        std::this_thread::sleep_for(std::chrono::microseconds(500));
+                    }
+                }
+            });
+    }
+
+    if (option.find("del") == std::string::npos && option.find("observe") == std::string::npos)
     {
         for (s32 i = 0; i < 300; i++)
         {
             FrameBoot<TestServer>::DoTick(zclock::now_ms());
             std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            if (i % 100 == 0 && option.find("incr") != std::string::npos)
+            {
+                ASSERT_TEST(FrameBoot<TestServer>::SnapshotDeltaShm("./frame.snapshot") == 0);
+            }
+        }
+        if (option.find("snapshot") != std::string::npos)
+        {
+            ASSERT_TEST(FrameBoot<TestServer>::SnapshotShm("./frame.snapshot") == 0);
+        }
+        if (option.find("incr") != std::string::npos)
+        {
+            ASSERT_TEST(FrameBoot<TestServer>::SnapshotDeltaShm("./frame.snapshot") == 0);
+        }
+        if (option.find("compact") != std::string::npos)
+        {
+            ASSERT_TEST(FrameBoot<TestServer>::CompactSnapshot("./frame.snapshot") == 0);
+        }
+        if (cmd_producer.joinable())
+        {
+            cmd_exit = true;
+            cmd_producer.join();
         }
+        u64 cmd_gaps = SubSpace<TestServer, kMainFrame>()->cmd_gaps_;
+        ASSERT_TEST(cmd_gaps == 0);
         ASSERT_TEST(boot_server("exit") == 0);
     }
 
@@ -0,0 +1,731 @@
+/*
+* Copyright (C) 2019 YaweiZhang <yawei.zhang@foxmail.com>.
+* All rights reserved
+* This file is part of the zframe, used MIT License.
+*/
+
+
+#include "frame_def.h"
+#include "pool_foreach.h"
+#include "frame_io.h"
+#include "test_common.h"
+#include "ztest.h"
+
+
+class Npc
+{
+public:
+    Npc() : hp_(100), level_(1), pos_x_(0), pos_y_(0) {}
+    s32 hp_;
+    s32 level_;
+    f32 pos_x_;
+    f32 pos_y_;
+};
+
+
+//single create/destroy vs create_n/destroy_n
+s32 bench_pool_batch(s32 count)
+{
+    s64 space_size = zmem_pool::calculate_space_size(sizeof(Npc), count, true);
+    std::unique_ptr<char[]> space(new char[space_size]);
+    std::unique_ptr<s32[]> ids(new s32[count]);
+    std::unique_ptr<Npc*[]> objs(new Npc*[count]);
+    zmem_pool pool;
+    zclock clock;
+
+    //one round from a fresh pool (exploit_ tail), one round from the free list
+    for (s32 round = 0; round < 2; round++)
+    {
+        ASSERT_TEST_NOLOG(pool.init(sizeof(Npc), 0, 0, count, space.get(), space_size, true) == 0);
+        if (round == 1)
+        {
+            ASSERT_TEST_NOLOG(pool.create_n<Npc>(count, ids.get()) == count);
+            ASSERT_TEST_NOLOG(pool.destroy_n<Npc>(ids.get(), count) == 0);
+        }
+        clock.start();
+        for (s32 i = 0; i < count; i++)
+        {
+            objs[i] = pool.create<Npc>();
+        }
+        clock.save();
+        s64 single_create = clock.duration_ns();
+        ASSERT_TEST_NOLOG(pool.size() == count);
+
+        clock.start();
+        for (s32 i = 0; i < count; i++)
+        {
+            pool.destroy<Npc>(objs[i]);
+        }
+        clock.save();
+        s64 single_destroy = clock.duration_ns();
+        ASSERT_TEST_NOLOG(pool.empty());
+
+        ASSERT_TEST_NOLOG(pool.init(sizeof(Npc), 0, 0, count, space.get(), space_size, true) == 0);
+        if (round == 1)
+        {
+            ASSERT_TEST_NOLOG(pool.create_n<Npc>(count, ids.get()) == count);
+            ASSERT_TEST_NOLOG(pool.destroy_n<Npc>(ids.get(), count) == 0);
+        }
+        clock.start();
+        s32 created = pool.create_n<Npc>(count, ids.get());
+        clock.save();
+        s64 batch_create = clock.duration_ns();
+        ASSERT_TEST_NOLOG(created == count && pool.size() == count && pool.full());
+        ASSERT_TEST_NOLOG(pool.cast<Npc>(ids[count - 1])->hp_ == 100);
+        ASSERT_TEST_NOLOG(pool.peek_used(count - 1, count) == (u32)count - 1 && pool.peek_used(1, 1) == 1);
+
+        clock.start();
+        pool.destroy_n<Npc>(ids.get(), count);
+        clock.save();
+        s64 batch_destroy = clock.duration_ns();
+        ASSERT_TEST_NOLOG(pool.empty());
+        ASSERT_TEST_NOLOG(pool.peek_used(0, (u32)count) >= (u32)count);
+
+        LogInfo() << "pool " << (round == 0 ? "tail" : "free list") << " count:" << count
+            << " create:" << single_create / count << "." << single_create * 10 / count % 10 << "ns -> create_n:"
+            << batch_create / count << "." << batch_create * 10 / count % 10 << "ns"
+            << ", destroy:" << single_destroy / count << "." << single_destroy * 10 / count % 10 << "ns -> destroy_n:"
+            << batch_destroy / count << "." << batch_destroy * 10 / count % 10 << "ns";
+    }
+    return 0;
+}
+
+
+//add/cancel/expire of timers across all wheel levels, every timer fired at its ms.
+s32 bench_timer_wheel(s32 count)
+{
+    s64 space_size = ztimer_wheel::calculate_space_size(count);
+    std::unique_ptr<char[]> space(new char[space_size]);
+    std::unique_ptr<u64[]> ids(new u64[count]);
+    std::unique_ptr<ztimer_wheel> wheel(new ztimer_wheel());
+    const s64 begin_ms = 1000;
+    const s64 max_delay = 20 * 60 * 1000;
+    ASSERT_TEST_NOLOG(wheel->init(count, space.get(), space_size, begin_ms) == 0);
+    zclock clock;
+
+    u64 seed = 0x9e3779b97f4a7c15ULL;
+    clock.start();
+    for (s32 i = 0; i < count; i++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        s64 delay = (s64)((seed >> 33) % max_delay);
+        ids[i] = wheel->add(begin_ms + delay, 0, (u64)(begin_ms + delay));
+        ASSERT_TEST_NOLOG(ids[i] != 0);
+    }
+    clock.save();
+    s64 add_ns = clock.duration_ns();
+
+    clock.start();
+    s32 canceled = 0;
+    for (s32 i = 0; i < count; i += 4)
+    {
+        ASSERT_TEST_NOLOG(wheel->cancel(ids[i]) == 0);
+        canceled++;
+    }
+    clock.save();
+    s64 cancel_ns = clock.duration_ns();
+    ASSERT_TEST_NOLOG(wheel->cancel(ids[0]) != 0);
+
+    u32 fired = 0;
+    u32 wrong = 0;
+    clock.start();
+    for (s64 now_ms = begin_ms; now_ms <= begin_ms + max_delay; now_ms += 10)
+    {
+        fired += wheel->expire(now_ms, [&wrong, now_ms](u64 timer_id, u32 callback_id, u64 userdata, s64 expire_ms)
+            {
+                if ((s64)userdata != expire_ms || expire_ms > now_ms || expire_ms + 10 <= now_ms)
+                {
+                    wrong++;
+                }
+            });
+    }
+    clock.save();
+    s64 expire_ns = clock.duration_ns();
+    ASSERT_TEST_NOLOG(wrong == 0);
+    ASSERT_TEST_NOLOG(fired == (u32)(count - canceled));
+    ASSERT_TEST_NOLOG(wheel->size() == 0);
+
+    LogInfo() << "timer wheel count:" << count << " add:" << add_ns / count << "ns, cancel:" << cancel_ns / canceled
+        << "ns, expire " << max_delay / 1000 << "s of 10ms ticks:" << expire_ns / 1000 / 1000 << "ms";
+    return 0;
+}
+
+
+class Mob
+{
+public:
+    virtual ~Mob() {}
+    virtual s32 Tick(s64 now_ms) { hp_ += (s32)now_ms; return 0; }
+    s32 hp_ = 0;
+    char cold_[48];
+};
+
+s32 MobTick(void* mob, s64 now_ms)
+{
+    return ((Mob*)mob)->Tick(now_ms);
+}
+
+//ForeachInst::run over one pool: fixed() per object vs repaired pool + prefetch pipeline vs span tick of member.
+s32 bench_foreach_prefetch(s32 count)
+{
+    s64 pool_size = zmem_pool::calculate_space_size(sizeof(Mob), count);
+    s64 head_size = SPACE_ALIGN(sizeof(zshm_space));
+    std::unique_ptr<char[]> frame(new char[head_size + sizeof(PoolSpace) + pool_size + 64]);
+    char* base = frame.get() + (64 - (u64)frame.get() % 64) % 64;
+    memset(base, 0, head_size + sizeof(PoolSpace));
+    g_shm_space = (zshm_space*)base;
+    g_shm_space->subs_[ShmSpace::kPool].offset_ = head_size;
+    PoolSpace* space = SubSpace<PoolSpace, ShmSpace::kPool>();
+    zmem_pool& pool = space->pools_[0];
+    ASSERT_TEST_NOLOG(pool.init_with_object<Mob>(0, count, base + head_size + sizeof(PoolSpace), pool_size) == 0);
+    for (s32 i = 0; i < count; i++)
+    {
+        ASSERT_TEST_NOLOG(pool.create<Mob>() != nullptr);
+    }
+
+    ForeachInst inst;
+    memset(&inst, 0, sizeof(inst));
+    inst.pool_id_ = 0;
+    inst.tick_ = MobTick;
+    s32 rounds = std::max(1, 4 * 1000 * 1000 / count);
+    s64 cost[4] = { 0 };
+    zclock clock;
+    for (s32 mode = 0; mode < 4; mode++)
+    {
+        pool.vptr_fixed_ = mode == 0 ? 0 : 1;
+        inst.prefetch_distance_ = mode == 2 ? 8 : 0;
+        inst.span_tick_ = mode == 3 ? &PoolMemberTick<Mob, &Mob::Tick> : nullptr;
+        inst.run(0, count, 1);
+        clock.start();
+        for (s32 r = 0; r < rounds; r++)
+        {
+            inst.run(0, count, 1);
+        }
+        clock.save();
+        cost[mode] = clock.duration_ns() * 10 / rounds / count;
+    }
+    ASSERT_TEST_NOLOG(pool.cast<Mob>(count - 1)->hp_ == rounds * 4 + 4);
+    g_shm_space = nullptr;
+
+    LogInfo() << "foreach pool count:" << count << " (" << pool_size / 1024 << "KB) per object: fixed:" << cost[0] / 10 << "." << cost[0] % 10
+        << "ns, repaired:" << cost[1] / 10 << "." << cost[1] % 10 << "ns, repaired+prefetch:" << cost[2] / 10 << "." << cost[2] % 10
+        << "ns, span member tick:" << cost[3] / 10 << "." << cost[3] % 10 << "ns";
+    return 0;
+}
+
+
+static s64 g_io_bytes = 0;
+static s32 g_io_errors = 0;
+static void OnBenchIO(u64 userdata, s64 result)
+{
+    if (result < 0)
+    {
+        g_io_errors++;
+        return;
+    }
+    g_io_bytes += result;
+}
+
+//tick thread cost of writing 16 x 4KB + fsync every tick: sync io vs worker threads vs io_uring.
+s32 bench_frame_io(s32 ticks)
+{
+    const u32 kBlocks = 16;
+    const u32 kBlockSize = 4096;
+    std::unique_ptr<char[]> buf(new char[kBlocks * kBlockSize]);
+    memset(buf.get(), 'z', kBlocks * kBlockSize);
+    const char* names[] = { "sync", "threads", "io_uring" };
+    for (s32 mode = FrameIO::kIOSync; mode <= (s32)FrameIO::kIOUring; mode++)
+    {
+        s32 fd = open("./bench_io.tmp", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ASSERT_TEST_NOLOG(fd >= 0);
+        FrameIO& io = FrameIO::Instance();
+        io.Start(mode == FrameIO::kIOUring, mode == FrameIO::kIOThreads ? 2 : 0);
+        if ((s32)io.Backend() != mode)
+        {
+            LogWarn() << "frame io " << names[mode] << " not available, skip.";
+            io.Stop();
+            close(fd);
+            continue;
+        }
+        g_io_bytes = 0;
+        g_io_errors = 0;
+        s64 total_ns = 0;
+        s64 max_ns = 0;
+        zclock clock;
+        for (s32 t = 0; t < ticks; t++)
+        {
+            clock.start();
+            io.Reap();
+            for (u32 i = 0; i < kBlocks; i++)
+            {
+                io.Write(fd, buf.get() + i * kBlockSize, kBlockSize, ((s64)t * kBlocks + i) * kBlockSize, OnBenchIO, 0);
+            }
+            io.Fsync(fd, OnBenchIO, 0);
+            io.Submit();
+            clock.save();
+            total_ns += clock.duration_ns();
+            max_ns = std::max(max_ns, clock.duration_ns());
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        io.Wait();
+        io.Stop();
+        close(fd);
+        ASSERT_TEST_NOLOG(g_io_errors == 0);
+        ASSERT_TEST_NOLOG(g_io_bytes == (s64)ticks * kBlocks * kBlockSize);
+        LogInfo() << "frame io " << names[mode] << " ticks:" << ticks << " write " << kBlocks * kBlockSize / 1024 << "KB + fsync per tick, tick thread cost avg:"
+            << total_ns / ticks / 1000 << "us, max:" << max_ns / 1000 << "us, stalls:" << io.Stalls();
+    }
+    remove("./bench_io.tmp");
+    return 0;
+}
+
+
+static s32 g_io_fd = -1;
+static s32 g_io_busy = 0;
+static char g_io_line[16] = "frame io busy\n";
+static void OnIORequeue(u64 userdata, s64 result)
+{
+    //only the slot of this request is free, the table is full after the first one.
+    for (s32 i = 0; i < 3; i++)
+    {
+        g_io_busy += FrameIO::Instance().Write(g_io_fd, g_io_line, sizeof(g_io_line), -1, OnBenchIO, 0) != 0 ? 1 : 0;
+    }
+}
+
+//a callback queues more requests than the free slots at full depth: refused, not stalled.
+s32 test_frame_io_busy()
+{
+    const char* names[] = { "sync", "threads", "io_uring" };
+    for (s32 mode = FrameIO::kIOSync; mode <= (s32)FrameIO::kIOUring; mode++)
+    {
+        g_io_fd = open("./bench_io.tmp", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ASSERT_TEST_NOLOG(g_io_fd >= 0);
+        FrameIO& io = FrameIO::Instance();
+        io.Start(mode == FrameIO::kIOUring, mode == FrameIO::kIOThreads ? 2 : 0, 2);
+        if ((s32)io.Backend() != mode)
+        {
+            io.Stop();
+            close(g_io_fd);
+            continue;
+        }
+        g_io_busy = 0;
+        g_io_errors = 0;
+        ASSERT_TEST_NOLOG(io.Write(g_io_fd, g_io_line, sizeof(g_io_line), -1, OnIORequeue, 0) == 0);
+        ASSERT_TEST_NOLOG(io.Write(g_io_fd, g_io_line, sizeof(g_io_line), -1, OnIORequeue, 0) == 0);
+        io.Wait();
+        io.Stop();
+        close(g_io_fd);
+        ASSERT_TEST_NOLOG(g_io_errors == 0 && g_io_busy > 0);
+        LogInfo() << "frame io " << names[mode] << " requests refused in callbacks at full depth:" << g_io_busy;
+    }
+    remove("./bench_io.tmp");
+    return 0;
+}
+
+
+//worker threads alloc/free small objects: one locked zmalloc vs per-thread caches (ztcache), 1 ~ 32 threads.
+s32 bench_thread_cache(s32 rounds)
+{
+    const u32 kLive = 64;
+    std::unique_ptr<char[]> zspace(new char[sizeof(zmalloc_arenas) + sizeof(ztcache) + 128]);
+    char* base = zspace.get() + (64 - (u64)zspace.get() % 64) % 64;
+    zmalloc_arenas* arenas = (zmalloc_arenas*)base;
+    ztcache* tcache = (ztcache*)(base + zmalloc_align_value(sizeof(zmalloc_arenas), 64));
+    arenas->init(nullptr, nullptr);
+    zmalloc* zstate = &arenas->arena(0);
+    tcache->init(arenas);
+
+    const char* names[] = { "locked zmalloc", "thread cache" };
+    for (s32 threads = 1; threads <= 32; threads *= 2)
+    {
+        s64 cost[2] = { 0 };
+        for (s32 mode = 0; mode < 2; mode++)
+        {
+            std::atomic<s32> errors(0);
+            std::vector<std::thread> workers;
+            zclock clock;
+            clock.start();
+            for (s32 t = 0; t < threads; t++)
+            {
+                workers.emplace_back([=, &errors]()
+                    {
+                        void* live[kLive] = { nullptr };
+                        u32 seed = (u32)t * 2654435761U + 1;
+                        for (s32 r = 0; r < rounds; r++)
+                        {
+                            for (u32 i = 0; i < kLive; i++)
+                            {
+                                seed = seed * 1103515245U + 12345U;
+                                u64 bytes = 8 + (seed >> 16) % 500;
+                                if (mode == 0)
+                                {
+                                    tcache->lock();
+                                    live[i] = zstate->alloc_memory(bytes);
+                                    tcache->unlock();
+                                }
+                                else
+                                {
+                                    live[i] = tcache->alloc_memory(bytes);
+                                }
+                                if (live[i] == nullptr)
+                                {
+                                    errors++;
+                                    continue;
+                                }
+                                *(u64*)live[i] = bytes;
+                            }
+                            for (u32 i = 0; i < kLive; i++)
+                            {
+                                if (live[i] == nullptr)
+                                {
+                                    continue;
+                                }
+                                u64 req_bytes = *(u64*)live[i];
+                                u64 bytes = 0;
+                                if (mode == 0)
+                                {
+                                    tcache->lock();
+                                    bytes = zstate->free_memory(live[i]);
+                                    tcache->unlock();
+                                }
+                                else
+                                {
+                                    bytes = tcache->free_memory(live[i]);
+                                }
+                                if (bytes < req_bytes)
+                                {
+                                    errors++;
+                                }
+                                live[i] = nullptr;
+                            }
+                        }
+                        if (mode == 1)
+                        {
+                            tcache->release_thread();
+                        }
+                    });
+            }
+            for (auto& worker : workers)
+            {
+                worker.join();
+            }
+            clock.save();
+            ASSERT_TEST_NOLOG(errors.load() == 0);
+            ASSERT_TEST_NOLOG(tcache->used_threads() == 0);
+            cost[mode] = clock.duration_ns() * 10 / ((s64)threads * rounds * kLive);
+        }
+        LogInfo() << "alloc+free threads:" << threads << " per pair (wall): " << names[0] << ":" << cost[0] / 10 << "." << cost[0] % 10
+            << "ns, " << names[1] << ":" << cost[1] / 10 << "." << cost[1] % 10 << "ns";
+    }
+
+    //a freed chunk stays in the bin of this thread, bind through the cache gives it back first.
+    tcache->free_memory(tcache->alloc_memory<3>(64));
+    ASSERT_TEST_NOLOG(arenas->live_count(3) != 0 && arenas->bind_color(3, 1) == -2);
+    ASSERT_TEST_NOLOG(tcache->bind_color(3, 1) == 0 && arenas->live_count(3) == 0);
+    ASSERT_TEST_NOLOG(tcache->bind_color(3, 0) == 0);
+
+    //a chunk shrunk in place is cached by its new size, the next alloc of the old size must not get it back.
+    void* shrunk = tcache->alloc_memory(800);
+    ASSERT_TEST_NOLOG(shrunk != nullptr && tcache->try_expand(shrunk, 100) && tcache->usable_size(shrunk) < 800);
+    tcache->free_memory(shrunk);
+    void* again = tcache->alloc_memory(800);
+    ASSERT_TEST_NOLOG(again != nullptr && tcache->usable_size(again) >= 800);
+    memset(again, 0xcd, 800);
+    again = tcache->realloc_memory(again, 2000);
+    ASSERT_TEST_NOLOG(again != nullptr && tcache->usable_size(again) >= 2000);
+    tcache->free_memory(again);
+
+    //the tail cut off in place is free without the color of its owner, a chunk of another color carved there keeps only its own.
+    auto chunk_color = [](void* addr) { return (u32)(zmalloc_chunk_cast(zmalloc_u64_cast(addr) - zmalloc::CHUNK_PADDING_SIZE)->flags & zmalloc::CHUNK_COLOR_MASK) >> 1; };
+    ASSERT_TEST_NOLOG(arenas->bind_color(5, 1) == 0 && arenas->bind_color(2, 1) == 0);
+    void* owner = arenas->alloc_memory<5>(600);
+    ASSERT_TEST_NOLOG(owner != nullptr && arenas->try_expand(owner, 64));
+    void* other = arenas->alloc_memory<2>(520);
+    ASSERT_TEST_NOLOG(other != nullptr && chunk_color(other) == 2 && &arenas->owner_of(other) == &arenas->arena(1));
+    arenas->free_memory(other);
+    arenas->free_memory(owner);
+    ASSERT_TEST_NOLOG(arenas->live_count(5) == 0 && arenas->live_count(2) == 0);
+    arenas->arena(1).check_panic();
+
+    //so is the front gap of an aligned chunk, a small chunk of another color carved from it keeps only its own.
+    void* gapped = arenas->alloc_aligned<5>(200, 256);
+    ASSERT_TEST_NOLOG(gapped != nullptr && (u64)gapped % 256 == 0);
+    other = arenas->alloc_memory<2>(48);
+    ASSERT_TEST_NOLOG(other != nullptr && chunk_color(other) == 2 && &arenas->owner_of(other) == &arenas->arena(1));
+    arenas->free_memory(other);
+    arenas->free_memory(gapped);
+    ASSERT_TEST_NOLOG(arenas->live_count(5) == 0 && arenas->live_count(2) == 0);
+    arenas->arena(1).check_panic();
+
+    //the front gap and tail of an aligned chunk are cut off, it is cached by the size left.
+    void* aligned = tcache->alloc_aligned(200, 256);
+    ASSERT_TEST_NOLOG(aligned != nullptr && (u64)aligned % 256 == 0 && tcache->usable_size(aligned) < 488);
+    tcache->free_memory(aligned);
+    again = tcache->alloc_memory(488);
+    ASSERT_TEST_NOLOG(again != nullptr && tcache->usable_size(again) >= 488);
+    tcache->free_memory(again);
+    tcache->release_thread();
+    ASSERT_TEST_NOLOG(zstate->req_total_count_ - zstate->free_total_count_ == 0);
+    ASSERT_TEST_NOLOG(zstate->runtime_errors_ == 0);
+    zstate->check_panic();
+    zstate->clear_cache();
+    return 0;
+}
+
+
+//shm_map workloads on zmalloc: chunk path vs slab tier. memory per object is the used chunk bytes (with heads) + used slab pages at peak.
+template<class Map, class MakeValue>
+s32 bench_shm_map_run(const char* name, s32 count, MakeValue make_value)
+{
+    std::unique_ptr<char[]> zspace(new char[sizeof(zmalloc) + 64]);
+    zmalloc* zstate = (zmalloc*)(zspace.get() + (64 - (u64)zspace.get() % 64) % 64);
+    const char* modes[] = { "chunk", "slab" };
+    s64 insert_ns[2] = { 0 };
+    s64 erase_ns[2] = { 0 };
+    u64 used_bytes[2] = { 0 };
+    for (s32 mode = 0; mode < 2; mode++)
+    {
+        memset(zstate, 0, sizeof(zmalloc));
+        zstate->set_slab_threshold(mode == 0 ? 0 : zmalloc::SLAB_MAX_REQUEST);
+        zstate->set_global(zstate);
+        if (true)
+        {
+            Map m;
+            zclock clock;
+            clock.start();
+            for (s32 i = 0; i < count; i++)
+            {
+                m.emplace(i, make_value(i));
+            }
+            clock.save();
+            insert_ns[mode] = clock.duration_ns() * 10 / count;
+            used_bytes[mode] = zstate->alloc_total_bytes_ - zstate->free_total_bytes_ + (u64)zstate->slab_page_count_ * zmalloc::SLAB_PAGE_SIZE;
+            clock.start();
+            for (s32 i = 0; i < count; i += 2)
+            {
+                m.erase(i);
+            }
+            for (s32 i = 1; i < count; i += 2)
+            {
+                m.erase(i);
+            }
+            clock.save();
+            erase_ns[mode] = clock.duration_ns() * 10 / count;
+            ASSERT_TEST_NOLOG(m.empty());
+        }
+        ASSERT_TEST_NOLOG(zstate->req_total_count_ == zstate->free_total_count_);
+        ASSERT_TEST_NOLOG(zstate->runtime_errors_ == 0);
+        ASSERT_TEST_NOLOG(zstate->slab_page_count_ == 0);
+        zstate->check_panic();
+        zstate->release_all();
+        zstate->set_global(nullptr);
+    }
+    for (s32 mode = 0; mode < 2; mode++)
+    {
+        LogInfo() << name << " count:" << count << " " << modes[mode] << ": insert " << insert_ns[mode] / 10 << "." << insert_ns[mode] % 10
+            << "ns/op, erase " << erase_ns[mode] / 10 << "." << erase_ns[mode] % 10 << "ns/op, memory " << used_bytes[mode] * 10 / count / 10 << "." << used_bytes[mode] * 10 / count % 10 << "B/object";
+    }
+    return 0;
+}
+
+s32 bench_shm_map(s32 count)
+{
+    using IntMap = shm_map<s32, s32>;
+    using NameMap = shm_map<s32, shm_string>;
+    ASSERT_TEST_NOLOG(bench_shm_map_run<IntMap>("shm_map<s32,s32>", count, [](s32 i) { return i; }) == 0);
+    return bench_shm_map_run<NameMap>("shm_map<s32,shm_string(24)>", count, [](s32 i)
+        {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "name_of_object_%09d", i);
+            return shm_string(buf);
+        });
+}
+
+
+//vector push_back growth on zmalloc: shm_vector (alloc + copy + free) vs zallocator::reallocate (grow in place when the next chunk is free).
+//buffers is the count of vectors pushed in turn, neighbours of a growing chunk are in use more often.
+s32 bench_vector_growth(s32 count, s32 buffers)
+{
+    const s32 kMaxBuffers = 4;
+    const s32 kRounds = 20;
+    ASSERT_TEST_NOLOG(buffers > 0 && buffers <= kMaxBuffers);
+    std::unique_ptr<char[]> zspace(new char[sizeof(zmalloc) + 64]);
+    zmalloc* zstate = (zmalloc*)(zspace.get() + (64 - (u64)zspace.get() % 64) % 64);
+    memset(zstate, 0, sizeof(zmalloc));
+    zstate->set_slab_threshold(zmalloc::SLAB_MAX_REQUEST);
+    zstate->set_global(zstate);
+
+    s64 cost[2] = { 0 };
+    u64 grows = 0;
+    u64 in_place = 0;
+    for (s32 mode = 0; mode < 2; mode++)
+    {
+        zclock clock;
+        clock.start();
+        for (s32 round = 0; round < kRounds; round++)
+        {
+            s64 sum = 0;
+            if (mode == 0)
+            {
+                shm_vector<s32> vts[kMaxBuffers];
+                for (s32 i = 0; i < count; i++)
+                {
+                    for (s32 b = 0; b < buffers; b++)
+                    {
+                        vts[b].push_back(i);
+                    }
+                }
+                for (s32 b = 0; b < buffers; b++)
+                {
+                    sum += vts[b][count - 1];
+                }
+            }
+            else
+            {
+                zallocator<s32, MEM_COLOR_VECTOR> alloc;
+                s32* data[kMaxBuffers] = { nullptr };
+                s32 cap[kMaxBuffers] = { 0 };
+                for (s32 i = 0; i < count; i++)
+                {
+                    for (s32 b = 0; b < buffers; b++)
+                    {
+                        if (i == cap[b])
+                        {
+                            s32* new_data = alloc.reallocate(data[b], cap[b] == 0 ? 16 : cap[b] * 2);
+                            ASSERT_TEST_NOLOG(new_data != nullptr);
+                            grows++;
+                            in_place += new_data == data[b] ? 1 : 0;
+                            data[b] = new_data;
+                            cap[b] = (s32)alloc.capacity(new_data);
+                        }
+                        data[b][i] = i;
+                    }
+                }
+                for (s32 b = 0; b < buffers; b++)
+                {
+                    sum += data[b][count - 1];
+                    alloc.deallocate(data[b], cap[b]);
+                }
+            }
+            ASSERT_TEST_NOLOG(sum == (s64)(count - 1) * buffers);
+        }
+        clock.save();
+        cost[mode] = clock.duration_ns() * 10 / ((s64)kRounds * count * buffers);
+    }
+    ASSERT_TEST_NOLOG(zstate->req_total_count_ == zstate->free_total_count_);
+    ASSERT_TEST_NOLOG(zstate->runtime_errors_ == 0);
+    zstate->check_panic();
+    zstate->release_all();
+    zstate->set_global(nullptr);
+    LogInfo() << "push_back count:" << count << " buffers:" << buffers << " shm_vector:" << cost[0] / 10 << "." << cost[0] % 10
+        << "ns/op, reallocate:" << cost[1] / 10 << "." << cost[1] % 10 << "ns/op, in place grows:" << in_place << "/" << grows;
+    return 0;
+}
+
+
+//bulk construction: alloc_memory/free_memory per object vs alloc_batch/free_batch. then alloc_aligned for 32 ~ 4096 align.
+s32 bench_batch_alloc(s32 count)
+{
+    std::unique_ptr<char[]> zspace(new char[sizeof(zmalloc) + 64]);
+    zmalloc* zstate = (zmalloc*)(zspace.get() + (64 - (u64)zspace.get() % 64) % 64);
+    memset(zstate, 0, sizeof(zmalloc));
+    zstate->set_slab_threshold(zmalloc::SLAB_MAX_REQUEST);
+    std::unique_ptr<void*[]> ptrs(new void*[count]);
+    const u64 sizes[] = { 64, 256, 900, 4000 };
+    for (u64 bytes : sizes)
+    {
+        s64 cost[2] = { 0 };
+        //the first round warms the blocks, the second is measured.
+        for (s32 pass = 0; pass < 4; pass++)
+        {
+            s32 mode = pass % 2;
+            zclock clock;
+            clock.start();
+            if (mode == 0)
+            {
+                for (s32 i = 0; i < count; i++)
+                {
+                    ptrs[i] = zstate->alloc_memory(bytes);
+                }
+            }
+            else
+            {
+                ASSERT_TEST_NOLOG(zstate->alloc_batch(bytes, (u32)count, ptrs.get()) == (u32)count);
+            }
+            for (s32 i = 0; i < count; i++)
+            {
+                ASSERT_TEST_NOLOG(ptrs[i] != nullptr && zstate->usable_size(ptrs[i]) >= bytes);
+                *(u64*)ptrs[i] = bytes;
+            }
+            if (mode == 0)
+            {
+                for (s32 i = 0; i < count; i++)
+                {
+                    zstate->free_memory(ptrs[i]);
+                }
+            }
+            else
+            {
+                zstate->free_batch(ptrs.get(), (u32)count);
+            }
+            clock.save();
+            cost[mode] = clock.duration_ns() * 10 / count;
+        }
+        LogInfo() << "alloc+free count:" << count << " bytes:" << bytes << " single:" << cost[0] / 10 << "." << cost[0] % 10
+            << "ns/op, batch:" << cost[1] / 10 << "." << cost[1] % 10 << "ns/op";
+    }
+
+    const u64 aligns[] = { 32, 64, 256, 4096 };
+    for (u64 align : aligns)
+    {
+        zclock clock;
+        clock.start();
+        for (s32 i = 0; i < count; i++)
+        {
+            u64 bytes = 8 + (u64)i * 7 % 2000;
+            ptrs[i] = zstate->alloc_aligned(bytes, align);
+            ASSERT_TEST_NOLOG(ptrs[i] != nullptr && (u64)ptrs[i] % align == 0 && zstate->usable_size(ptrs[i]) >= bytes);
+            memset(ptrs[i], 0xcd, bytes);
+        }
+        zstate->free_batch(ptrs.get(), (u32)count);
+        clock.save();
+        zstate->check_panic();
+        s64 cost = clock.duration_ns() * 10 / count;
+        LogInfo() << "alloc_aligned+free count:" << count << " align:" << align << " cost:" << cost / 10 << "." << cost % 10 << "ns/op";
+    }
+    ASSERT_TEST_NOLOG(zstate->alloc_aligned(64, 48) == nullptr);
+    ASSERT_TEST_NOLOG(zstate->req_total_count_ == zstate->free_total_count_);
+    ASSERT_TEST_NOLOG(zstate->slab_alloc_count_ == zstate->slab_free_count_);
+    ASSERT_TEST_NOLOG(zstate->runtime_errors_ == 0);
+    zstate->check_panic();
+    zstate->release_all();
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    FNLog::FastStartDebugLogger();
+
+    ASSERT_TEST(bench_pool_batch(1000) == 0);
+    ASSERT_TEST(bench_pool_batch(100 * 1000) == 0);
+    ASSERT_TEST(bench_pool_batch(1000 * 1000) == 0);
+    ASSERT_TEST(bench_timer_wheel(1000 * 1000) == 0);
+    ASSERT_TEST(bench_foreach_prefetch(256) == 0);
+    ASSERT_TEST(bench_foreach_prefetch(4 * 1024) == 0);
+    ASSERT_TEST(bench_foreach_prefetch(64 * 1024) == 0);
+    ASSERT_TEST(bench_foreach_prefetch(1024 * 1024) == 0);
+    ASSERT_TEST(bench_frame_io(200) == 0);
+    ASSERT_TEST(test_frame_io_busy() == 0);
+    ASSERT_TEST(bench_thread_cache(20 * 1000) == 0);
+    ASSERT_TEST(bench_shm_map(100 * 1000) == 0);
+    ASSERT_TEST(bench_shm_map(1000 * 1000) == 0);
+    ASSERT_TEST(bench_vector_growth(1000, 1) == 0);
+    ASSERT_TEST(bench_vector_growth(100 * 1000, 1) == 0);
+    ASSERT_TEST(bench_vector_growth(100 * 1000, 2) == 0);
+    ASSERT_TEST(bench_batch_alloc(1000) == 0);
+    ASSERT_TEST(bench_batch_alloc(100 * 1000) == 0);
+
+    LogInfo() << "all test finish .";
+    return 0;
+}
@@ -12,6 +12,7 @@
 
 #include <stdint.h>
 #include "zmalloc.h"
+#include "ztcache.h"
 #include <memory>
 #include <limits>
 #include <cstddef>
@@ -65,16 +66,34 @@ public:
 
     inline pointer allocate(size_type cnt, typename std::allocator<void>::const_pointer = 0)
     {
-        return reinterpret_cast<pointer>(zmalloc::instance().alloc_memory<_Color>((u64)cnt * (u64)sizeof(_Ty)));
+        return reinterpret_cast<pointer>(ztcache::alloc_global<_Color>((u64)cnt * (u64)sizeof(_Ty)));
     }
     inline void deallocate(pointer p, size_type c)
     {
-        u64 free_size = zmalloc::instance().free_memory(p);
+        u64 free_size = ztcache::free_global(p);
         (void)free_size;
         (void)c;
         //assert free_size > c * sizeof(Ty); 
     }
 
+    //extension for containers which manage their own buffer: grow or shrink the block of p without copy.
+    //false when it can't be done in place, p is still valid with the old size.
+    inline bool try_expand(pointer p, size_type cnt)
+    {
+        return ztcache::try_expand_global(p, (u64)cnt * (u64)sizeof(_Ty));
+    }
+    //elements the block of p can hold, not less than the allocated count.
+    inline size_type capacity(pointer p) const
+    {
+        return (size_type)(ztcache::usable_size_global(p) / sizeof(_Ty));
+    }
+    //in place when it can, else moved by memcpy. only for trivially copyable elements.
+    inline pointer reallocate(pointer p, size_type cnt)
+    {
+        static_assert(std::is_trivially_copyable<_Ty>::value, "reallocate moves elements by memcpy");
+        return reinterpret_cast<pointer>(ztcache::realloc_global<_Color>(p, (u64)cnt * (u64)sizeof(_Ty)));
+    }
+
     template <class... Args>
     inline void construct(pointer p, Args&&... args) { new (p) _Ty(std::forward<Args>(args)...); }
     inline void construct(pointer p) { new (p) _Ty(); }
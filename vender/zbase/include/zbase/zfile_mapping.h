@@ -333,6 +333,13 @@ namespace zfile_mapping_impl
             {
                 file_data_ = (char*)mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, file_fd_, 0);
             }
+            if (file_data_ == MAP_FAILED)
+            {
+                close(file_fd_);
+                file_fd_ = -1;
+                file_data_ = NULL;
+                return 12;
+            }
             file_size_ = sb.st_size;
 #endif 
             return 0;
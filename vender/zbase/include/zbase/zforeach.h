@@ -13,6 +13,7 @@
 #include <stdint.h>
 #include <memory>
 #include <cstddef>
+#include "zclock.h"
 
 #ifdef WIN32
 #pragma warning( push )
@@ -77,6 +78,12 @@ namespace zforeach_impl
         u32 soft_end_;
         u32 cur_step_;
         u32 foreach_cursor_; //locked cursor when soft window has change   
+
+        //adaptive slicing: budget_us_ is 0 when use fixed sub steps.  
+        u32 budget_us_; 
+        u32 cost_ns_; //ewma of one id cost  
+        u64 overrun_count_; //steps over budget to keep all ids visited in long frame  
+        u64 carry_over_; //ids behind the even schedule, carried to next steps   
     };
 
     static inline s32 init(subframe& sub, u64 userkey, u64 userdata, u32 begin_id, u32 end_id, subframe::Hook hook, s32 base_frame_len, s32 long_frame_len)
@@ -120,6 +127,33 @@ namespace zforeach_impl
         return 0;
     }
 
+    static inline void set_budget(subframe& sub, u32 budget_us)
+    {
+        sub.budget_us_ = budget_us;
+        sub.cost_ns_ = 0;
+    }
+
+    //count of ids in this step.  
+    static inline u32 step_count(const subframe& sub)
+    {
+        u32 span = sub.soft_end_ - sub.soft_begin_;
+        u32 even_count = (span + sub.sub_steps_ - 1) / sub.sub_steps_;
+        if (sub.budget_us_ == 0 || sub.cost_ns_ == 0)
+        {
+            return even_count;
+        }
+        //at least visit the rest in left steps. (cur_step_ 0 is the last step)  
+        u32 left_ids = sub.soft_end_ > sub.foreach_cursor_ ? sub.soft_end_ - sub.foreach_cursor_ : 0;
+        u32 left_steps = sub.cur_step_ == 0 ? 1 : sub.sub_steps_ - sub.cur_step_ + 1;
+        u32 min_count = (left_ids + left_steps - 1) / left_steps;
+        u64 budget_count = sub.budget_us_ * 1000ULL / sub.cost_ns_;
+        if (budget_count < min_count)
+        {
+            return min_count;
+        }
+        return budget_count > left_ids ? left_ids : (u32)budget_count;
+    }
+
     static inline bool is_valid(const subframe& sub)
     {
         if (sub.hook_ == NULL)
@@ -145,7 +179,7 @@ namespace zforeach_impl
         }
         sub.cur_step_ = (sub.cur_step_ + 1) % sub.sub_steps_;
         u32 cur_begin_id = sub.foreach_cursor_;
-        u32 cur_end_id = sub.foreach_cursor_ + (sub.soft_end_ - sub.soft_begin_ + sub.sub_steps_ - 1) / sub.sub_steps_ ;
+        u32 cur_end_id = sub.foreach_cursor_ + step_count(sub);
         if (cur_end_id > sub.soft_end_)
         {
             cur_end_id = sub.soft_end_;
@@ -163,7 +197,35 @@ namespace zforeach_impl
         }
         //쳣 resumeῪʼһ   
 
+        if (sub.budget_us_ == 0)
+        {
+            sub.hook_(sub, cur_begin_id, cur_end_id, now_ms);
+            return 0;
+        }
+
+        if (cur_begin_id >= cur_end_id)
+        {
+            sub.carry_over_ = 0;
+            return 0;
+        }
+        zclock clock;
+        clock.start();
         sub.hook_(sub, cur_begin_id, cur_end_id, now_ms);
+        clock.save();
+        u32 count = cur_end_id - cur_begin_id;
+        u64 cost_ns = (u64)clock.duration_ns() / count + 1;
+        sub.cost_ns_ = sub.cost_ns_ == 0 ? (u32)cost_ns : (u32)((sub.cost_ns_ * 7ULL + cost_ns) / 8);
+        if ((u64)clock.duration_ns() > sub.budget_us_ * 1000ULL)
+        {
+            sub.overrun_count_++;
+        }
+
+        //the even schedule of fixed mode after this step  
+        u32 span = sub.soft_end_ - sub.soft_begin_;
+        u32 passed_steps = sub.cur_step_ == 0 ? sub.sub_steps_ : sub.cur_step_;
+        u64 even_cursor = sub.soft_begin_ + (u64)(span + sub.sub_steps_ - 1) / sub.sub_steps_ * passed_steps;
+        even_cursor = even_cursor > sub.soft_end_ ? sub.soft_end_ : even_cursor;
+        sub.carry_over_ = even_cursor > cur_end_id ? even_cursor - cur_end_id : 0;
         return 0;
     }
 
@@ -188,17 +250,24 @@ public:
         return 0;
     }
 
+    //userdata is the address of this, rebind it when moved (e.g. vector growth).   
     inline s32 resume(const _THookObj& inst)
     {
         foreach_inst_ = inst;
+        subframe_.userdata_ = (u64)(void*)this;
         subframe_.hook_ = &zforeach<_THookObj>::global_hook;
         return 0;
     }
     inline s32 resume()
     {
+        subframe_.userdata_ = (u64)(void*)this;
         subframe_.hook_ = &zforeach<_THookObj>::global_hook;
         return 0;
     }
+    //adaptive slicing: fit ids of one step to budget_us by measured cost, 0 is off.  
+    inline void set_budget(u32 budget_us) { zforeach_impl::set_budget(subframe_, budget_us); }
+    inline u64 overrun_count() const { return subframe_.overrun_count_; }
+    inline u64 carry_over() const { return subframe_.carry_over_; }
     inline s32 window_foreach(u32 win_begin, u32 win_end, s64 now_ms)
     { 
         //hard bound auto fixed.   
@@ -99,6 +99,24 @@ inline u32 zmalloc_last_bit_index(u64 num)
 #define zmalloc_last_bit_index(num) ((u32)(__builtin_ctzll((u64)num)))
 #endif
 
+//u32 fields read without the lock by other threads, the struct itself stays trivial for memset in shm.
+#ifdef WIN32
+inline u32 zmalloc_load_acquire(const u32* addr)
+{
+    u32 val = *(const volatile u32*)addr;
+    _ReadWriteBarrier();
+    return val;
+}
+inline void zmalloc_store_release(u32* addr, u32 val)
+{
+    _ReadWriteBarrier();
+    *(volatile u32*)addr = val;
+}
+#else
+#define zmalloc_load_acquire(addr) __atomic_load_n(addr, __ATOMIC_ACQUIRE)
+#define zmalloc_store_release(addr, val) __atomic_store_n(addr, val, __ATOMIC_RELEASE)
+#endif
+
 template<class Integer>
 inline Integer zmalloc_fill_right(Integer num)
 {
@@ -201,11 +219,31 @@ public:
     template<u16 COLOR = 0>
     inline void* alloc_memory(u64 bytes);
     inline u64  free_memory(void* addr);
+    //bytes can be used of an allocated addr (not less than request).
+    inline u64 usable_size(void* addr);
+    //grow (merge the following free chunk) or shrink in place, false when it can't, addr is unchanged anyway.
+    inline bool try_expand(void* addr, u64 bytes);
+    //try_expand first, else alloc + copy + free. NULL addr is alloc, 0 bytes is free.
+    template<u16 COLOR = 0>
+    inline void* realloc_memory(void* addr, u64 bytes);
+    //align is power of 2 and not more than SLAB_PAGE_SIZE, aligned chunks must be less than BIG_MAX_REQUEST. free by free_memory.
+    template<u16 COLOR = 0>
+    inline void* alloc_aligned(u64 bytes, u64 align);
+    //count chunks of the same size, small chunks are picked from its exact bin and carved from dv in one pass.
+    //return the count allocated (less than count when no more memory), out[0, ret) are set.
+    template<u16 COLOR = 0>
+    inline u32 alloc_batch(u64 bytes, u32 count, void** out);
+    //NULL is skipped. return freed bytes.
+    inline u64 free_batch(void** addrs, u32 count);
         
 
     inline s32 check_health();
     inline void check_panic();
     inline void clear_cache();
+    inline u64 release_all();
+
+    //slab tier: requests <= bytes (0 is off, max SLAB_MAX_REQUEST) are packed in header-less slots of size class pages.
+    inline void set_slab_threshold(u32 bytes) { slab_threshold_ = bytes > SLAB_MAX_REQUEST ? SLAB_MAX_REQUEST : bytes; }
     template<class StreamLog>
     inline void debug_state_log(StreamLog logwrap);
     template<class StreamLog>
@@ -271,15 +309,51 @@ public:
     static_assert(zmalloc_is_power_of_2(DEFAULT_BLOCK_SIZE), "");
     static_assert(sizeof(zmalloc::block_type) == zmalloc_order_size(zmalloc::LEAST_ALIGN_SHIFT + 1), "block align");
     static const u32 BLOCK_TYPE_SIZE = sizeof(zmalloc::block_type);
+
+    static const u32 SLAB_PAGE_SHIFT = 12U; //not more than the os page: the page head of any addr is always readable
+    static const u32 SLAB_PAGE_SIZE = zmalloc_order_size(SLAB_PAGE_SHIFT);
+    static const u32 SLAB_MAX_REQUEST = 128;
+    static const u32 SLAB_CLASS_COUNT = SLAB_MAX_REQUEST >> FINE_GRAINED_SHIFT; //16, 32, ... 128
+    static const u32 SLAB_COLOR_COUNT = CHUNK_COLOR_MASK / 2 + 1;
+    static const u32 SLAB_BLOCK_SIZE = 1024 * 1024;
+    static const u32 SLAB_MAX_BLOCKS = 256;
+    static const u32 SLAB_MAGIC = 0x51ab51ab;
+
+    //head of a slab page, slots follow it.
+    struct slab_page
+    {
+        u32 magic;
+        u16 class_size;
+        u8 color;
+        u8 reserve;
+        u32 block_index;
+        u32 used;
+        zmalloc* owner;
+        void* free_list;
+        slab_page* prev;
+        slab_page* next;
+        u64 padding[2];
+    };
+    static_assert(sizeof(slab_page) == 64, "slots of page align the least align.");
+    static const u32 SLAB_PAGE_SLOTS_SIZE = SLAB_PAGE_SIZE - sizeof(slab_page);
+
+    //page head of addr, it maybe not a slab page. check it by find_slab.
+    //find_slab is lock free (thread caches free without the lock), see the comment at its definition.
+    inline static slab_page* slab_page_cast(void* addr) { return (slab_page*)((u64)addr & ~(u64)(SLAB_PAGE_SIZE - 1)); }
+    inline slab_page* find_slab(void* addr);
 private:
     inline free_chunk_type* alloc_block(u32 bytes, u32 flag);
     inline u64 free_block(block_type* block);
     inline void push_chunk(free_chunk_type* chunk, u32 bin_id);
     inline void push_small_chunk(free_chunk_type* chunk);
     inline void push_big_chunk(free_chunk_type* chunk);
+    inline void rebin_used_chunk(chunk_type* chunk);
     inline bool pick_chunk(free_chunk_type* chunk);
     inline free_chunk_type* exploit_new_chunk(free_chunk_type* devide_chunk, u32 new_chunk_size);
     inline u64  merge_and_release(free_chunk_type* chunk, u32 level, u64 bytes);
+    inline void* slab_alloc(u32 req_bytes, u32 color);
+    inline u64 slab_free(slab_page* page, void* addr);
+    inline slab_page* slab_new_page(u32 class_size, u32 color);
 public:
     inline static void check_color_counter(zmalloc& zstate, chunk_type* c);
     inline static void check_chunk(chunk_type* c);
@@ -323,6 +397,18 @@ public:
     free_chunk_type* dv_[BITMAP_LEVEL];
     free_chunk_type bin_[BITMAP_LEVEL][BINMAP_SIZE];
     free_chunk_type bin_end_[BITMAP_LEVEL][BINMAP_SIZE];
+
+    u32 slab_threshold_;
+    u32 slab_block_count_;
+    u32 slab_block_pages_; //pages of the last block carved
+    u32 slab_page_count_; //pages not empty
+    u64 slab_alloc_count_;
+    u64 slab_free_count_;
+    u64 slab_block_bytes_;
+    slab_page* slab_empty_pages_;
+    slab_page* slab_partial_[SLAB_COLOR_COUNT][SLAB_CLASS_COUNT]; //pages with free slots
+    u64 slab_block_addr_[SLAB_MAX_BLOCKS]; //first page of block
+    void* slab_block_raw_[SLAB_MAX_BLOCKS];
 #if ZMALLOC_OPEN_COUNTER
     u32 bin_size_[BITMAP_LEVEL][BINMAP_SIZE];
     u64 alloc_counter_[CHUNK_COLOR_MASK_WITH_LEVEL + 1][BINMAP_SIZE];
@@ -676,6 +762,29 @@ void zmalloc::push_big_chunk(free_chunk_type* chunk)
     push_chunk(chunk, bin_id);
 }
 
+//an in-used chunk resized in place: bin_id is the bin of its new size, the same as it would be pushed to.
+//ztcache files a freed chunk by bin_id, so it must never be larger than the chunk can serve.
+void zmalloc::rebin_used_chunk(chunk_type* chunk)
+{
+    u32 bytes = chunk->this_size - CHUNK_PADDING_SIZE;
+    u32 bin_id = 0;
+    if (zmalloc_chunk_level(chunk) == 0)
+    {
+        bin_id = bytes >> FINE_GRAINED_SHIFT;
+        bin_id = bin_id >= BINMAP_SIZE ? BINMAP_SIZE - 1 : bin_id;
+    }
+    else
+    {
+        u32 third_order = zmalloc_align_third_bit_order(bytes);
+        bin_id = zmalloc_third_sequence_compress(zmalloc_third_sequence(third_order, bytes));
+    }
+#if ZMALLOC_OPEN_COUNTER
+    alloc_counter_[zmalloc_chunk_color_level(chunk)][chunk->bin_id]--;
+    alloc_counter_[zmalloc_chunk_color_level(chunk)][bin_id]++;
+#endif
+    chunk->bin_id = bin_id;
+}
+
 //typedef void (*InsertFree)(free_chunk_type* chunk);
 //static const InsertFree push_chunkFunc[] = { &push_small_chunk , &push_big_chunk };
 
@@ -708,6 +817,166 @@ zmalloc::free_chunk_type* zmalloc::exploit_new_chunk(free_chunk_type* devide_chu
     return new_chunk;
 }
 
+/*
+* lock free, other threads may append slab blocks meanwhile:
+* slab_block_addr_[n] is stored before slab_block_count_ is released as n + 1 and never changes until release_all,
+* so an index below the acquired count always reads its real block.
+* the page head maybe user data of a live chunk of another thread, its value is only a candidate:
+* the answer is decided by the block table. an addr in a slab block is a slab slot, and its page head was
+* written before the slot was handed out, so it's stable. an addr out of all slab blocks is never a slab slot
+* whatever the head reads.
+*/
+zmalloc::slab_page* zmalloc::find_slab(void* addr)
+{
+    slab_page* page = slab_page_cast(addr);
+    if (page->magic != SLAB_MAGIC || page->owner != this || page->block_index >= zmalloc_load_acquire(&slab_block_count_))
+    {
+        return NULL;
+    }
+    //the head maybe user data of a chunk, the block range is the real check.
+    u64 begin = slab_block_addr_[page->block_index];
+    if (zmalloc_u64_cast(page) < begin || zmalloc_u64_cast(page) >= begin + SLAB_BLOCK_SIZE)
+    {
+        return NULL;
+    }
+    return page;
+}
+
+zmalloc::slab_page* zmalloc::slab_new_page(u32 class_size, u32 color)
+{
+    slab_page* page = slab_empty_pages_;
+    if (page != NULL)
+    {
+        slab_empty_pages_ = page->next;
+    }
+    else
+    {
+        if (slab_block_count_ == 0 || slab_block_pages_ == 0)
+        {
+            if (slab_block_count_ >= SLAB_MAX_BLOCKS)
+            {
+                return NULL;
+            }
+            void* raw = block_alloc_ ? block_alloc_(SLAB_BLOCK_SIZE) : default_block_alloc(SLAB_BLOCK_SIZE);
+            if (raw == NULL)
+            {
+                return NULL;
+            }
+            u64 first = zmalloc_align_value(zmalloc_u64_cast(raw), (u64)SLAB_PAGE_SIZE);
+            slab_block_raw_[slab_block_count_] = raw;
+            slab_block_addr_[slab_block_count_] = first;
+            slab_block_pages_ = (u32)((zmalloc_u64_cast(raw) + SLAB_BLOCK_SIZE - first) >> SLAB_PAGE_SHIFT);
+            zmalloc_store_release(&slab_block_count_, slab_block_count_ + 1); //publish after the block addr
+            slab_block_bytes_ += SLAB_BLOCK_SIZE;
+        }
+        u32 block_index = slab_block_count_ - 1;
+        u64 pages = (zmalloc_u64_cast(slab_block_raw_[block_index]) + SLAB_BLOCK_SIZE - slab_block_addr_[block_index]) >> SLAB_PAGE_SHIFT;
+        page = (slab_page*)(slab_block_addr_[block_index] + ((pages - slab_block_pages_) << SLAB_PAGE_SHIFT));
+        page->block_index = block_index;
+        slab_block_pages_--;
+    }
+    page->magic = SLAB_MAGIC;
+    page->class_size = (u16)class_size;
+    page->color = (u8)color;
+    page->used = 0;
+    page->owner = this;
+    page->prev = NULL;
+    page->next = NULL;
+    char* slot = (char*)page + sizeof(slab_page);
+    u32 count = SLAB_PAGE_SLOTS_SIZE / class_size;
+    page->free_list = slot;
+    for (u32 i = 0; i + 1 < count; i++)
+    {
+        *(void**)(slot + i * class_size) = slot + (i + 1) * class_size;
+    }
+    *(void**)(slot + (count - 1) * class_size) = NULL;
+    slab_page_count_++;
+    return page;
+}
+
+void* zmalloc::slab_alloc(u32 req_bytes, u32 color)
+{
+    u32 class_id = req_bytes == 0 ? 0 : ((req_bytes + FINE_GRAINED_MASK) >> FINE_GRAINED_SHIFT) - 1;
+    slab_page*& head = slab_partial_[color][class_id];
+    slab_page* page = head;
+    if (page == NULL)
+    {
+        page = slab_new_page((class_id + 1) << FINE_GRAINED_SHIFT, color);
+        if (page == NULL)
+        {
+            return NULL;
+        }
+        head = page;
+    }
+    void* slot = page->free_list;
+    page->free_list = *(void**)slot;
+    page->used++;
+    if (page->free_list == NULL)
+    {
+        //full page leaves the partial list
+        head = page->next;
+        if (head != NULL)
+        {
+            head->prev = NULL;
+        }
+        page->next = NULL;
+    }
+    slab_alloc_count_++;
+    return slot;
+}
+
+u64 zmalloc::slab_free(slab_page* page, void* addr)
+{
+    u32 class_size = page->class_size;
+    if (((zmalloc_u64_cast(addr) - zmalloc_u64_cast(page) - sizeof(slab_page)) % class_size) != 0 || page->used == 0)
+    {
+        runtime_errors_++;
+        return 0;
+    }
+    slab_page*& head = slab_partial_[page->color][(class_size >> FINE_GRAINED_SHIFT) - 1];
+    bool was_full = page->free_list == NULL;
+    *(void**)addr = page->free_list;
+    page->free_list = addr;
+    page->used--;
+    slab_free_count_++;
+    free_total_count_++;
+    if (page->used == 0)
+    {
+        //empty page goes back to the empty list for any class
+        if (!was_full)
+        {
+            if (page->prev != NULL)
+            {
+                page->prev->next = page->next;
+            }
+            else
+            {
+                head = page->next;
+            }
+            if (page->next != NULL)
+            {
+                page->next->prev = page->prev;
+            }
+        }
+        page->magic = 0;
+        page->prev = NULL;
+        page->next = slab_empty_pages_;
+        slab_empty_pages_ = page;
+        slab_page_count_--;
+    }
+    else if (was_full)
+    {
+        page->prev = NULL;
+        page->next = head;
+        if (head != NULL)
+        {
+            head->prev = page;
+        }
+        head = page;
+    }
+    return class_size;
+}
+
 #ifdef _WIN32
 #pragma warning( push ) 
 #pragma warning( disable : 4146 )  
@@ -727,7 +996,9 @@ void* zmalloc::alloc_memory(u64 req_bytes)
         auto cache_block_alloc = block_alloc_;
         auto cache_block_free = block_free_;
         auto block_allloc_power_of_2 = block_power_is_2_;
+        auto cache_slab_threshold = slab_threshold_;
         memset(this, 0, sizeof(zmalloc));
+        slab_threshold_ = cache_slab_threshold;
         max_reserve_block_count_= cache_max_reserve_block_count;
         block_alloc_ = cache_block_alloc;
         block_free_ = cache_block_free;
@@ -752,6 +1023,14 @@ void* zmalloc::alloc_memory(u64 req_bytes)
     }
     req_total_bytes_ += req_bytes;
     req_total_count_++;
+    if (req_bytes <= slab_threshold_)
+    {
+        void* slot = slab_alloc((u32)req_bytes, COLOR);
+        if (slot != NULL)
+        {
+            return slot;
+        }
+    }
     free_chunk_type* chunk = NULL;
     if (req_bytes < SMALL_MAX_REQUEST - FINE_GRAINED_SIZE)
     {
@@ -947,6 +1226,14 @@ u64 zmalloc::free_memory(void* addr)
         //LogError() << "free null";
         return 0;
     }
+    if (slab_block_count_ > 0)
+    {
+        slab_page* page = find_slab(addr);
+        if (page != NULL)
+        {
+            return slab_free(page, addr);
+        }
+    }
     free_chunk_type* chunk = zmalloc_free_chunk_cast(zmalloc_u64_cast(addr) - CHUNK_PADDING_SIZE);
     if (!zmalloc_chunk_in_use(chunk))
     {
@@ -1061,13 +1348,284 @@ u64  zmalloc::merge_and_release(free_chunk_type* chunk, u32 level, u64 bytes)
     return bytes;
 }
 
+u64 zmalloc::usable_size(void* addr)
+{
+    if (addr == NULL)
+    {
+        return 0;
+    }
+    if (slab_block_count_ > 0)
+    {
+        slab_page* page = find_slab(addr);
+        if (page != NULL)
+        {
+            return page->class_size;
+        }
+    }
+    return zmalloc_chunk_cast(zmalloc_u64_cast(addr) - CHUNK_PADDING_SIZE)->this_size - CHUNK_PADDING_SIZE;
+}
+
+bool zmalloc::try_expand(void* addr, u64 bytes)
+{
+    if (addr == NULL || bytes >= BIG_MAX_REQUEST)
+    {
+        return false;
+    }
+    if (slab_block_count_ > 0)
+    {
+        slab_page* page = find_slab(addr);
+        if (page != NULL)
+        {
+            return bytes <= page->class_size;
+        }
+    }
+    free_chunk_type* chunk = zmalloc_free_chunk_cast(zmalloc_u64_cast(addr) - CHUNK_PADDING_SIZE);
+    if (!zmalloc_chunk_in_use(chunk) || zmalloc_chunk_is_dirct(chunk))
+    {
+        return false;
+    }
+    u32 level = zmalloc_chunk_level(chunk);
+    u32 least_size = level == 0 ? SMALL_LEAST_SIZE : BIG_LEAST_SIZE;
+    u32 new_size = (u32)zmalloc_align_value(bytes < FINE_GRAINED_SIZE ? FINE_GRAINED_SIZE : bytes, FINE_GRAINED_SIZE) + CHUNK_PADDING_SIZE;
+    new_size = new_size < least_size ? least_size : new_size; //big chunks stay in big bins
+    if (new_size <= chunk->this_size)
+    {
+        //shrink: give the tail back when it can be a free chunk.
+        if (chunk->this_size - new_size >= least_size)
+        {
+            free_chunk_type* tail = exploit_new_chunk(chunk, chunk->this_size - new_size);
+            //exploit_new_chunk carves the tail, chunk keeps its head and used flags.
+            //the tail is a free chunk: only the level, the color of the owner would leak to the next chunk carved there.
+            tail->flags = chunk->flags & CHUNK_LEVEL_MASK;
+            tail->fence = CHUNK_FENCE;
+            alloc_total_bytes_ -= tail->this_size;
+            merge_and_release(tail, level, tail->this_size);
+        }
+        rebin_used_chunk(chunk);
+        return true;
+    }
+    free_chunk_type* next = zmalloc_free_chunk_cast(zmalloc_next_chunk(chunk));
+    u32 need = new_size - chunk->this_size;
+    if (zmalloc_chunk_in_use(next) || next->this_size < need)
+    {
+        return false;
+    }
+    bool is_dv = next == dv_[level];
+    if (!is_dv)
+    {
+        pick_chunk(next);
+    }
+    u32 next_size = next->this_size;
+    u32 next_flags = next->flags;
+    if (next_size - need >= least_size)
+    {
+        free_chunk_type* rest = zmalloc_free_chunk_cast(zmalloc_u64_cast(next) + need);
+        rest->flags = next_flags;
+        rest->fence = CHUNK_FENCE;
+        rest->prev_size = new_size;
+        rest->this_size = next_size - need;
+        rest->bin_id = 0;
+        zmalloc_next_chunk(rest)->prev_size = rest->this_size;
+        chunk->this_size = new_size;
+        alloc_total_bytes_ += need;
+        if (is_dv)
+        {
+            dv_[level] = rest;
+        }
+        else if (level == 0)
+        {
+            push_small_chunk(rest);
+        }
+        else
+        {
+            push_big_chunk(rest);
+        }
+    }
+    else
+    {
+        chunk->this_size += next_size;
+        zmalloc_next_chunk(chunk)->prev_size = chunk->this_size;
+        alloc_total_bytes_ += next_size;
+        if (is_dv)
+        {
+            dv_[level] = NULL;
+        }
+    }
+    rebin_used_chunk(chunk);
+    zmalloc_check_chunk(chunk);
+    return true;
+}
+
+template<u16 COLOR>
+void* zmalloc::realloc_memory(void* addr, u64 bytes)
+{
+    if (addr == NULL)
+    {
+        return alloc_memory<COLOR>(bytes);
+    }
+    if (bytes == 0)
+    {
+        free_memory(addr);
+        return NULL;
+    }
+    if (try_expand(addr, bytes))
+    {
+        return addr;
+    }
+    void* new_addr = alloc_memory<COLOR>(bytes);
+    if (new_addr == NULL)
+    {
+        return NULL;
+    }
+    u64 old_bytes = usable_size(addr);
+    memcpy(new_addr, addr, old_bytes < bytes ? old_bytes : bytes);
+    free_memory(addr);
+    return new_addr;
+}
+
+template<u16 COLOR>
+void* zmalloc::alloc_aligned(u64 bytes, u64 align)
+{
+    if (align == 0 || (align & (align - 1)) != 0 || align > SLAB_PAGE_SIZE)
+    {
+        return NULL;
+    }
+    if (align <= zmalloc_order_size(LEAST_ALIGN_SHIFT))
+    {
+        return alloc_memory<COLOR>(bytes);
+    }
+    //slab slots are at page head + n * class size, aligned when the class size is a multiple of align.
+    u64 class_size = zmalloc_align_value(bytes < FINE_GRAINED_SIZE ? FINE_GRAINED_SIZE : bytes, align);
+    if (align <= sizeof(slab_page) && class_size <= slab_threshold_)
+    {
+        void* slot = alloc_memory<COLOR>(class_size);
+        if (slot == NULL || zmalloc_u64_cast(slot) % align == 0)
+        {
+            return slot;
+        }
+        free_memory(slot);
+    }
+    //over alloc, give the front gap back as a free chunk and shrink the tail. both the gap and the aligned chunk keep the least size of the level.
+    u64 least_size = bytes + align + SMALL_LEAST_SIZE < SMALL_MAX_REQUEST - FINE_GRAINED_SIZE ? SMALL_LEAST_SIZE : BIG_LEAST_SIZE;
+    u64 raw_bytes = (bytes < least_size ? least_size : bytes) + align + least_size;
+    if (raw_bytes >= BIG_MAX_REQUEST)
+    {
+        return NULL;
+    }
+    //raw must be a chunk, not a slab slot.
+    raw_bytes = raw_bytes <= slab_threshold_ ? slab_threshold_ + 1 : raw_bytes;
+    void* raw = alloc_memory<COLOR>(raw_bytes);
+    if (raw == NULL || zmalloc_u64_cast(raw) % align == 0)
+    {
+        return raw;
+    }
+    free_chunk_type* chunk = zmalloc_free_chunk_cast(zmalloc_u64_cast(raw) - CHUNK_PADDING_SIZE);
+    u32 level = zmalloc_chunk_level(chunk);
+    least_size = level == 0 ? SMALL_LEAST_SIZE : BIG_LEAST_SIZE;
+    u64 addr = zmalloc_align_value(zmalloc_u64_cast(raw) + least_size, align);
+    u32 gap = (u32)(addr - zmalloc_u64_cast(raw));
+    free_chunk_type* aligned = zmalloc_free_chunk_cast(addr - CHUNK_PADDING_SIZE);
+    aligned->flags = chunk->flags;
+    aligned->fence = CHUNK_FENCE;
+    aligned->prev_size = gap;
+    aligned->this_size = chunk->this_size - gap;
+    aligned->bin_id = chunk->bin_id; //counted in the bin of raw, moved to the bin of the final size below
+    zmalloc_next_chunk(aligned)->prev_size = aligned->this_size;
+    chunk->this_size = gap;
+    //the gap is a free chunk: only the level, the color of the owner would leak to the next chunk carved there.
+    chunk->flags &= CHUNK_LEVEL_MASK;
+    alloc_total_bytes_ -= gap;
+    merge_and_release(chunk, level, gap);
+    zmalloc_check_chunk(aligned);
+    if (!try_expand((void*)addr, bytes))
+    {
+        rebin_used_chunk(aligned);
+    }
+    return (void*)addr;
+}
+
+template<u16 COLOR>
+u32 zmalloc::alloc_batch(u64 bytes, u32 count, void** out)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    //the first one inits the state and makes sure a block of this level exists.
+    out[0] = alloc_memory<COLOR>(bytes);
+    if (out[0] == NULL)
+    {
+        return 0;
+    }
+    u32 done = 1;
+    if (bytes > slab_threshold_ && bytes < SMALL_MAX_REQUEST - FINE_GRAINED_SIZE)
+    {
+        constexpr u32 level = 0;
+        u32 small_id = (bytes < FINE_GRAINED_SIZE ? FINE_GRAINED_SIZE : (u32)bytes + FINE_GRAINED_MASK) >> FINE_GRAINED_SHIFT;
+        u32 padding = (small_id << FINE_GRAINED_SHIFT) + CHUNK_PADDING_SIZE;
+        u64 chunk_bytes = 0;
+        u32 first = done;
+        while (done < count)
+        {
+            free_chunk_type* chunk = NULL;
+            if (bin_[level][small_id].next_node != &bin_end_[level][small_id])
+            {
+                chunk = bin_[level][small_id].next_node;
+                pick_chunk(chunk);
+            }
+            else if (dv_[level] != NULL && dv_[level]->this_size >= padding + SMALL_LEAST_SIZE)
+            {
+                chunk = exploit_new_chunk(dv_[level], padding);
+            }
+            else
+            {
+                break;
+            }
+            zmalloc_set_chunk(chunk, CHUNK_IS_IN_USED | (COLOR * 2));
+            chunk->fence = CHUNK_FENCE;
+            chunk->bin_id = small_id;
+#ifdef ZDEBUG_UNINIT_MEMORY
+            memset((void*)(zmalloc_u64_cast(chunk) + CHUNK_PADDING_SIZE), 0xfd, chunk->this_size - CHUNK_PADDING_SIZE);
+#endif // ZDEBUG_UNINIT_MEMORY
+            chunk_bytes += chunk->this_size;
+            out[done++] = (void*)(zmalloc_u64_cast(chunk) + CHUNK_PADDING_SIZE);
+        }
+#if ZMALLOC_OPEN_COUNTER
+        alloc_counter_[(COLOR * 2)][small_id] += done - first;
+#endif
+        req_total_bytes_ += bytes * (done - first);
+        req_total_count_ += done - first;
+        alloc_total_bytes_ += chunk_bytes;
+    }
+    //slab slots, big chunks and the rest after the bin and dv run out.
+    for (; done < count; done++)
+    {
+        out[done] = alloc_memory<COLOR>(bytes);
+        if (out[done] == NULL)
+        {
+            break;
+        }
+    }
+    return done;
+}
+
+u64 zmalloc::free_batch(void** addrs, u32 count)
+{
+    u64 bytes = 0;
+    for (u32 i = 0; i < count; i++)
+    {
+        bytes += free_memory(addrs[i]);
+    }
+    return bytes;
+}
+
 s32 zmalloc::check_health()
 {
     if (!inited_)
     {
         return -1;
     }
-    check_bitmap(instance(), false);
+    check_bitmap(*this, false);
     return runtime_errors_;
 }
 
@@ -1077,8 +1635,8 @@ void zmalloc::check_panic()
     {
         return;
     }
-    check_block(instance());
-    check_bitmap(instance(), true);
+    check_block(*this);
+    check_bitmap(*this, true);
     if (runtime_errors_ > 0)
     {
         panic(false, "has runtime_errors");
@@ -1114,6 +1672,49 @@ void zmalloc::clear_cache()
     }
 }
 
+//give all blocks (used and reserved) back at once, every chunk of this state is dropped. the state is rebuilt by next alloc.
+u64 zmalloc::release_all()
+{
+    u64 bytes = 0;
+    block_type* lists[2] = { used_block_list_, reserve_block_list_ };
+    for (block_type* block : lists)
+    {
+        while (block)
+        {
+            block_type* release_block = block;
+            block = block->next;
+            bytes += release_block->block_size;
+            if (block_free_)
+            {
+                block_free_(release_block, release_block->block_size);
+            }
+            else
+            {
+                default_block_free(release_block);
+            }
+        }
+    }
+    for (u32 i = 0; i < slab_block_count_; i++)
+    {
+        bytes += SLAB_BLOCK_SIZE;
+        if (block_free_)
+        {
+            block_free_(slab_block_raw_[i], SLAB_BLOCK_SIZE);
+        }
+        else
+        {
+            default_block_free(slab_block_raw_[i]);
+        }
+    }
+    slab_block_count_ = 0;
+    used_block_list_ = NULL;
+    used_block_count_ = 0;
+    reserve_block_list_ = NULL;
+    reserve_block_count_ = 0;
+    inited_ = 0;
+    return bytes;
+}
+
 template<class StreamLog>
 inline void zmalloc::debug_state_log(StreamLog logwrap)
 {
@@ -1125,6 +1726,8 @@ inline void zmalloc::debug_state_log(StreamLog logwrap)
 
     logwrap() << "* [req]: alloc_block_count_:" << alloc_block_count_ << ", alloc_block_cached_(count):" << alloc_block_cached_  << ", alloc_block_bytes_:" << alloc_block_bytes_/1024.0/1024.0 <<"m.";
     logwrap() << "* [free]: free_block_count_:" << free_block_count_ << ", free_block_cached_(count):" << free_block_cached_ << ", free_block_bytes_:" << free_block_bytes_ / 1024.0 / 1024.0 << "m.";
+    logwrap() << "* [slab]: slab_threshold_:" << slab_threshold_ << ", slab_block_count_:" << slab_block_count_ << ", slab_page_count_:" << slab_page_count_
+        << ", slab_alloc_count_:" << slab_alloc_count_ << ", slab_free_count_:" << slab_free_count_ << ", slab_block_bytes_:" << slab_block_bytes_ / 1024.0 / 1024.0 << "m.";
 
 
 
@@ -0,0 +1,280 @@
+/*
+* Copyright (C) 2019 YaweiZhang <yawei.zhang@foxmail.com>.
+* All rights reserved
+* This file is part of the zbase, used MIT License.
+*/
+
+
+#pragma once
+#ifndef ZMALLOC_ARENAS_H
+#define ZMALLOC_ARENAS_H
+
+#include <stdint.h>
+#include <string.h>
+#include "zmalloc.h"
+
+#ifndef ZBASE_SHORT_TYPE
+#define ZBASE_SHORT_TYPE
+using s8 =  int8_t;
+using u8 =  uint8_t;
+using s16 = int16_t;
+using u16 = uint16_t;
+using s32 = int32_t;
+using u32 = uint32_t;
+using s64 = int64_t;
+using u64 = uint64_t;
+using f32 = float;
+using f64 = double;
+#endif
+
+
+/* type_traits:
+*
+* is_trivially_copyable: no (zmalloc bins point to itself)
+    * memset: yes (only in init)
+    * memcpy: no
+* shm resume : safely, require address fixed. call resume() to set the block callbacks again.
+    * has vptr:     no
+    * static var:   no
+    * has heap ptr: yes (blocks of every arena)
+    * has code ptr: yes (block callbacks)
+* thread safe: read safe
+*
+*/
+
+
+/*
+* a set of zmalloc states (arenas) sharing one block source (the buddy heap of frame).
+* every memory color is bound to one arena, arena 0 is the default one of all colors.
+* an arena has its own bins/dv/block lists, so long lived nodes and short lived buffers of different colors
+* don't fragment each other, and an arena can be released at once (scratch memory).
+* free finds the arena by the color in the chunk flags, so a color must not be bound again when it has live chunks.
+*/
+class zmalloc_arenas
+{
+public:
+    static constexpr u32 MAX_ARENAS = 8;
+    static constexpr u32 MAX_COLORS = zmalloc::CHUNK_COLOR_MASK / 2 + 1;
+
+public:
+    inline static zmalloc_arenas& instance() { return *instance_ptr(); }
+    inline static zmalloc_arenas*& instance_ptr() { static zmalloc_arenas* g_zmalloc_arenas = NULL; return g_zmalloc_arenas; }
+    inline static void set_global(zmalloc_arenas* state) { instance_ptr() = state; }
+
+    inline void init(zmalloc::block_alloc_func block_alloc, zmalloc::block_free_func block_free)
+    {
+        memset((void*)this, 0, sizeof(zmalloc_arenas));
+        resume(block_alloc, block_free);
+    }
+    inline void resume(zmalloc::block_alloc_func block_alloc, zmalloc::block_free_func block_free)
+    {
+        for (u32 i = 0; i < MAX_ARENAS; i++)
+        {
+            arenas_[i].set_block_callback(block_alloc, block_free);
+        }
+    }
+
+    inline void set_slab_threshold(u32 bytes)
+    {
+        for (u32 i = 0; i < MAX_ARENAS; i++)
+        {
+            arenas_[i].set_slab_threshold(bytes);
+        }
+    }
+
+    inline zmalloc& arena(u32 arena_id) { return arenas_[arena_id]; }
+    inline u32 arena_of(u32 color) const { return color < MAX_COLORS ? color_arena_[color] : 0; }
+    inline u64 live_count(u32 color) const { return color < MAX_COLORS ? color_live_[color] : 0; }
+
+    //-1 invalid color or arena (color 0 is always in arena 0), -2 the color has live chunks.
+    inline s32 bind_color(u32 color, u32 arena_id)
+    {
+        if (color == 0 || color >= MAX_COLORS || arena_id >= MAX_ARENAS)
+        {
+            return -1;
+        }
+        if (color_live_[color] != 0 && color_arena_[color] != arena_id)
+        {
+            return -2;
+        }
+        color_arena_[color] = (u8)arena_id;
+        return 0;
+    }
+
+    template<u16 COLOR = 0>
+    inline void* alloc_memory(u64 bytes)
+    {
+        static_assert(COLOR < MAX_COLORS, "");
+        void* addr = arenas_[color_arena_[COLOR]].alloc_memory<COLOR>(bytes);
+        if (addr != NULL)
+        {
+            color_live_[COLOR]++;
+        }
+        return addr;
+    }
+
+    inline u64 free_memory(void* addr)
+    {
+        if (addr == NULL)
+        {
+            return 0;
+        }
+        zmalloc::slab_page* page = find_slab(addr);
+        u32 color = page != NULL ? page->color : (zmalloc_chunk_cast(zmalloc_u64_cast(addr) - zmalloc::CHUNK_PADDING_SIZE)->flags & zmalloc::CHUNK_COLOR_MASK) >> 1;
+        color_live_[color]--;
+        return arenas_[color_arena_[color]].free_memory(addr);
+    }
+
+    template<u16 COLOR = 0>
+    inline void* alloc_aligned(u64 bytes, u64 align)
+    {
+        static_assert(COLOR < MAX_COLORS, "");
+        void* addr = arenas_[color_arena_[COLOR]].alloc_aligned<COLOR>(bytes, align);
+        if (addr != NULL)
+        {
+            color_live_[COLOR]++;
+        }
+        return addr;
+    }
+
+    template<u16 COLOR = 0>
+    inline u32 alloc_batch(u64 bytes, u32 count, void** out)
+    {
+        static_assert(COLOR < MAX_COLORS, "");
+        u32 done = arenas_[color_arena_[COLOR]].alloc_batch<COLOR>(bytes, count, out);
+        color_live_[COLOR] += done;
+        return done;
+    }
+
+    inline u64 free_batch(void** addrs, u32 count)
+    {
+        u64 bytes = 0;
+        for (u32 i = 0; i < count; i++)
+        {
+            bytes += free_memory(addrs[i]);
+        }
+        return bytes;
+    }
+
+    //arena of an allocated addr.
+    inline zmalloc& owner_of(void* addr)
+    {
+        zmalloc::slab_page* page = find_slab(addr);
+        if (page != NULL)
+        {
+            return *page->owner;
+        }
+        return arenas_[color_arena_[(zmalloc_chunk_cast(zmalloc_u64_cast(addr) - zmalloc::CHUNK_PADDING_SIZE)->flags & zmalloc::CHUNK_COLOR_MASK) >> 1]];
+    }
+
+    inline u64 usable_size(void* addr) { return addr == NULL ? 0 : owner_of(addr).usable_size(addr); }
+    inline bool try_expand(void* addr, u64 bytes) { return addr != NULL && owner_of(addr).try_expand(addr, bytes); }
+
+    template<u16 COLOR = 0>
+    inline void* realloc_memory(void* addr, u64 bytes)
+    {
+        if (addr == NULL)
+        {
+            return alloc_memory<COLOR>(bytes);
+        }
+        if (bytes == 0)
+        {
+            free_memory(addr);
+            return NULL;
+        }
+        if (try_expand(addr, bytes))
+        {
+            return addr;
+        }
+        void* new_addr = alloc_memory<COLOR>(bytes);
+        if (new_addr == NULL)
+        {
+            return NULL;
+        }
+        u64 old_bytes = usable_size(addr);
+        memcpy(new_addr, addr, old_bytes < bytes ? old_bytes : bytes);
+        free_memory(addr);
+        return new_addr;
+    }
+
+    //slab page of addr when addr is a slab slot of any arena.
+    inline zmalloc::slab_page* find_slab(void* addr)
+    {
+        zmalloc::slab_page* page = zmalloc::slab_page_cast(addr);
+        if (page->magic != zmalloc::SLAB_MAGIC)
+        {
+            return NULL;
+        }
+        //owner is checked before used, the head maybe user data of a chunk.
+        u64 owner = zmalloc_u64_cast(page->owner);
+        u64 begin = zmalloc_u64_cast(&arenas_[0]);
+        if (owner < begin || owner >= begin + sizeof(arenas_) || (owner - begin) % sizeof(zmalloc) != 0)
+        {
+            return NULL;
+        }
+        return page->owner->find_slab(addr);
+    }
+
+    /*
+    * drop all chunks of an arena at once and give its blocks back. the owner of the colors bound to it
+    * must not touch the dropped chunks anymore. return released bytes, negative is error (arena 0 can't be released).
+    */
+    inline s64 release_arena(u32 arena_id)
+    {
+        if (arena_id == 0 || arena_id >= MAX_ARENAS)
+        {
+            return -1;
+        }
+        for (u32 color = 0; color < MAX_COLORS; color++)
+        {
+            if (color_arena_[color] == arena_id)
+            {
+                color_live_[color] = 0;
+            }
+        }
+        return (s64)arenas_[arena_id].release_all();
+    }
+
+    inline void check_panic()
+    {
+        for (u32 i = 0; i < MAX_ARENAS; i++)
+        {
+            arenas_[i].check_panic();
+        }
+    }
+
+    //stats of every used arena.
+    template<class StreamLog>
+    inline void debug_state_log(StreamLog logwrap)
+    {
+        for (u32 i = 0; i < MAX_ARENAS; i++)
+        {
+            zmalloc& state = arenas_[i];
+            if (!state.inited_)
+            {
+                continue;
+            }
+            if (true)
+            {
+                auto&& log = logwrap();
+                log << "* [arena " << i << "]: colors:";
+                for (u32 color = 0; color < MAX_COLORS; color++)
+                {
+                    if (color_arena_[color] == i && (color_live_[color] != 0 || i != 0))
+                    {
+                        log << " " << color << "(live:" << color_live_[color] << ")";
+                    }
+                }
+            }
+            state.debug_state_log(logwrap);
+        }
+    }
+
+private:
+    u8 color_arena_[MAX_COLORS];
+    u64 color_live_[MAX_COLORS];
+    zmalloc arenas_[MAX_ARENAS];
+};
+
+
+#endif
@@ -15,6 +15,7 @@
 #include <string.h>
 #include <type_traits>
 #include <cstddef>
+#include "zbitset.h"
 
 #ifndef ZBASE_SHORT_TYPE
 #define ZBASE_SHORT_TYPE
@@ -23,7 +24,7 @@ using u8 =  uint8_t;
 using s16 = int16_t;
 using u16 = uint16_t;
 using s32 = int32_t;
-using s32 = unsigned int;
+using u32 = uint32_t;
 using s64 = int64_t;
 using u64 = uint64_t;
 using f32 = float;
@@ -36,6 +37,17 @@ using f64 = double;
 #define ZBASE_ALIAS
 #endif
 
+#ifndef ZBASE_PREFETCH
+#if defined(__GNUC__) || defined(__clang__)
+#define ZBASE_PREFETCH(addr) __builtin_prefetch((const void*)(addr))
+#elif defined(_MSC_VER)
+#include <xmmintrin.h>
+#define ZBASE_PREFETCH(addr) _mm_prefetch((const char*)(addr), _MM_HINT_T0)
+#else
+#define ZBASE_PREFETCH(addr) ((void)(addr))
+#endif
+#endif
+
 
 //#define ZDEBUG_UNINIT_MEMORY
 //#define ZDEBUG_DEATH_MEMORY
@@ -66,8 +78,10 @@ public:
     s32 chunk_size_;
     s32 used_count_;
     s32 free_id_;
+    s32 vptr_fixed_; //all used chunks have obj_vptr_, not need fixed() them  
     char* space_;
     s64  space_size_;
+    u64* used_bits_; //optional: bit of used chunk id, attached after chunks in space. raw words keep the pool trivial
     static constexpr u32 FENCE_4 = 0xbeafbeaf;
     static constexpr s32 HEAD_SIZE = 8;
     static constexpr u64 HEAD_USED = (1ULL << 63) | FENCE_4;
@@ -78,7 +92,11 @@ public:
 
     //8ֽڶ 
     static constexpr s32 align_size(s32 input_size) { return ((input_size == 0 ? 1 : input_size) + ALIGN_SIZE - 1) / ALIGN_SIZE * ALIGN_SIZE; }
-    constexpr static s64 calculate_space_size(s32 obj_size, s32 total_count) { return (HEAD_SIZE + align_size(obj_size)) * 1ULL * total_count + HEAD_SIZE; }
+    constexpr static s64 calculate_chunks_size(s32 obj_size, s32 total_count) { return (HEAD_SIZE + align_size(obj_size)) * 1ULL * total_count + HEAD_SIZE; }
+    constexpr static s64 calculate_space_size(s32 obj_size, s32 total_count, bool with_bitmap = false) 
+    { 
+        return calculate_chunks_size(obj_size, total_count) + (with_bitmap ? zbitset::ceil_array_size(total_count) * sizeof(u64) : 0);
+    }
 
     //utils: 
     template<class _Ty>
@@ -133,8 +151,11 @@ public:
         }
         return  p;
     }
+    //skip vptr check after the pool is repaired by resume.    
+    inline char* fast(s32 chunk_id) { return vptr_fixed_ ? at(chunk_id) : fixed(chunk_id); }
     template<class _Ty>
     inline _Ty* cast(s32 chunk_id) { return reinterpret_cast<_Ty*>(fixed(chunk_id)); }
+    inline s32 chunk_id(const void* obj) const { return (s32)(((const char*)obj - HEAD_SIZE - space_) / chunk_size_); }
 
 
     inline s32   chunk_size() const { return chunk_size_; }
@@ -152,13 +173,13 @@ public:
         return ret;
     }
 
-    inline s32 init(s32 obj_size, s32 name_id, u64 obj_vptr, s32 total_count, void* space, s64  space_size)
+    inline s32 init(s32 obj_size, s32 name_id, u64 obj_vptr, s32 total_count, void* space, s64  space_size, bool with_bitmap = false)
     {
         static_assert(sizeof(zmem_pool) % sizeof(s64) == 0, "");
         static_assert(align_size(0) == align_size(8), "");
         static_assert(align_size(7) == align_size(8), "");
 
-        s64 MIN_SPACE_SIZE = calculate_space_size(obj_size, total_count);
+        s64 MIN_SPACE_SIZE = calculate_space_size(obj_size, total_count, with_bitmap);
         if (space_size < MIN_SPACE_SIZE)
         {
             return -1;
@@ -183,14 +204,70 @@ public:
         exploit_ = 0;
         used_count_ = 0;
         free_id_ = obj_count_;
+        vptr_fixed_ = 1;
         space_ = (char*)space;
         space_size_ = space_size;
         chunk* end_chunk = (chunk*)(space_ + chunk_size_ * exploit_);
         //end_chunk->fence_ = FENCE_4;
         end_chunk->head_ = HEAD_UNUSED;
+        used_bits_ = nullptr;
+        if (with_bitmap)
+        {
+            used_bits_ = (u64*)(space_ + calculate_chunks_size(obj_size, total_count));
+            memset(used_bits_, 0, zbitset::ceil_array_size(total_count) * sizeof(u64));
+        }
         return 0;
     }
 
+    inline bool has_bitmap() const { return used_bits_ != nullptr; }
+    inline void set_used_bit(s32 id) { used_bits_[id / zbitset::BIT_WIDE] |= 1ULL << (id % zbitset::BIT_WIDE); }
+    inline void unset_used_bit(s32 id) { used_bits_[id / zbitset::BIT_WIDE] &= ~(1ULL << (id % zbitset::BIT_WIDE)); }
+
+    //first used chunk id in [bit_id, end_id), end_id when none. require has_bitmap() and end_id <= obj_count_.
+    inline u32 peek_used(u32 bit_id, u32 end_id) const
+    {
+        if (bit_id >= end_id)
+        {
+            return end_id;
+        }
+        u32 index = bit_id / zbitset::BIT_WIDE;
+        u32 end_index = (end_id + zbitset::BIT_WIDE_MASK) / zbitset::BIT_WIDE;
+        u64 unit = used_bits_[index] & (zbitset::BASE_MASK << (bit_id % zbitset::BIT_WIDE));
+        while (unit == 0)
+        {
+            if (++index >= end_index)
+            {
+                return end_id;
+            }
+            unit = used_bits_[index];
+        }
+#ifdef WIN32
+        unsigned long low_bit = 0;
+        _BitScanForward64(&low_bit, unit);
+#else
+        u32 low_bit = (u32)__builtin_ctzll(unit);
+#endif // WIN32
+        u32 id = index * zbitset::BIT_WIDE + (u32)low_bit;
+        return id < end_id ? id : end_id;
+    }
+
+    //rebuild used bitmap from chunk heads.   
+    void rebuild_bitmap()
+    {
+        if (!has_bitmap())
+        {
+            return;
+        }
+        memset(used_bits_, 0, zbitset::ceil_array_size(obj_count_) * sizeof(u64));
+        for (s32 i = 0; i < exploit_; i++)
+        {
+            if (ref(i)->used_)
+            {
+                set_used_bit(i);
+            }
+        }
+    }
+
     s32 health(void* obj, bool is_used) const 
     {
         char* addr = (char*)obj - HEAD_SIZE;
@@ -243,24 +320,95 @@ public:
         if (obj_vptr_ == 0 || vptr == 0)
         {
             //no vptr;  
+            vptr_fixed_ = 1;
             return 0;
         }
         obj_vptr_ = vptr;
+        vptr_fixed_ = 0;
+        s32 fixed_count = resume_range(0, exploit_);
+        if (fixed_count != used_count_)
+        {
+            return -1;
+        }
+        vptr_fixed_ = 1;
+        return 0;
+    }
+
+    /*
+    * fix vptr of used chunks in [begin_id, end_id) with obj_vptr_, return the count of used chunks.  
+    * only read the head word of unused chunks. not overlapped ranges can run in different threads.   
+    */
+    s32 resume_range(s32 begin_id, s32 end_id)
+    {
+        if (obj_vptr_ == 0)
+        {
+            return 0;
+        }
         s32 fixed_count = 0;
-        for (s32 i = 0; i < exploit_; i++)
+        char* addr = space_ + (s64)chunk_size_ * begin_id;
+        for (s32 i = begin_id; i < end_id; i++, addr += chunk_size_)
         {
-            chunk* c = ref(i);
-            if (!c->used_)
+            chunk* c = (chunk*)addr;
+            if ((c->head_ & HEAD_USED) != HEAD_USED)
             {
                 continue;
             }
-            fixed(i);
+            u64* vptr = (u64*)&c->data_;
+            if (*vptr != obj_vptr_)
+            {
+                *vptr = obj_vptr_;
+            }
             fixed_count++;
         }
-        if (fixed_count != used_count_)
+        return fixed_count;
+    }
+
+    /*
+    * relocate all chunks from an old pool which has same obj size and less or equal obj count.  
+    * chunk id is kept, src_space is the current address of src's chunks (src.space_ maybe invalid).  
+    * call it after init, and call resume after it to fix vptr.  
+    */
+    s32 relocate(const zmem_pool& src, const char* src_space)
+    {
+        if (src_space == nullptr)
         {
             return -1;
         }
+        if (src.chunk_size_ != chunk_size_ || src.obj_count_ > obj_count_)
+        {
+            return -2;
+        }
+        if (exploit_ != 0 || used_count_ != 0)
+        {
+            return -3;
+        }
+
+        //used/free chunks and the end fence    
+        memcpy(space_, src_space, (s64)chunk_size_ * src.exploit_ + HEAD_SIZE);
+        exploit_ = src.exploit_;
+        used_count_ = src.used_count_;
+        vptr_fixed_ = 0;
+        free_id_ = src.free_id_ == src.obj_count_ ? obj_count_ : src.free_id_;
+
+        rebuild_bitmap();
+
+        //the end of free list is obj_count_, rewrite it.    
+        s32 free_id = free_id_;
+        for (s32 i = 0; i < exploit_ && free_id != obj_count_; i++)
+        {
+            chunk* c = ref(free_id);
+            if ((s32)c->free_id_ == src.obj_count_)
+            {
+                c->free_id_ = obj_count_;
+                return 0;
+            }
+            free_id = c->free_id_;
+        }
+        if (free_id != obj_count_)
+        {
+            //broken free list  
+            return -4;
+        }
         return 0;
     }
 
@@ -270,6 +418,10 @@ public:
         if (free_id_ != obj_count_)
         {
             chunk* c = ref(free_id_);
+            if (has_bitmap())
+            {
+                set_used_bit(free_id_);
+            }
             free_id_ = c->free_id_;
             used_count_++;
 
@@ -285,6 +437,10 @@ public:
         }
         if (exploit_ < obj_count_)
         {
+            if (has_bitmap())
+            {
+                set_used_bit(exploit_);
+            }
             chunk* c = ref(exploit_ ++);
             used_count_++;
             c->head_ = HEAD_USED;
@@ -319,12 +475,129 @@ public:
         c->free_id_ = free_id_;
         free_id_ = (s32)((addr - space_)/chunk_size_);
         used_count_--;
+        if (has_bitmap())
+        {
+            unset_used_bit(free_id_);
+        }
 #ifdef ZDEBUG_DEATH_MEMORY
         memset(obj, 0xfd, chunk_size_ - HEAD_SIZE);
 #endif // ZDEBUG_DEATH_MEMORY
         return 0;
     }
 
+    /*
+    * exploit up to count chunks, write their chunk id to out_ids, return the exploited count.  
+    * carve a contiguous run from the exploit_ tail first, then pop the free list.  
+    */
+    inline s32 exploit_n(s32 count, s32* out_ids)
+    {
+        if (count <= 0 || out_ids == nullptr)
+        {
+            return 0;
+        }
+        s32 tail_count = obj_count_ - exploit_ < count ? obj_count_ - exploit_ : count;
+        char* addr = space_ + (s64)chunk_size_ * exploit_;
+        for (s32 i = 0; i < tail_count; i++, addr += chunk_size_)
+        {
+            ((chunk*)addr)->head_ = HEAD_USED;
+            out_ids[i] = exploit_ + i;
+#ifdef ZDEBUG_UNINIT_MEMORY
+            memset(addr + HEAD_SIZE, 0xfd, chunk_size_ - HEAD_SIZE);
+#endif // ZDEBUG_UNINIT_MEMORY
+        }
+        if (tail_count > 0)
+        {
+            if (has_bitmap())
+            {
+                for (s32 i = 0; i < tail_count; i++)
+                {
+                    set_used_bit(exploit_ + i);
+                }
+            }
+            exploit_ += tail_count;
+            ((chunk*)addr)->fence_ = FENCE_4;
+        }
+
+        s32 exploited = tail_count;
+        s32 free_id = free_id_;
+        while (exploited < count && free_id != obj_count_)
+        {
+            chunk* c = ref(free_id);
+            out_ids[exploited++] = free_id;
+            s32 next_id = c->free_id_;
+            c->head_ = HEAD_USED;
+            if (has_bitmap())
+            {
+                set_used_bit(free_id);
+            }
+#ifdef ZDEBUG_UNINIT_MEMORY
+            memset(&c->data_, 0xfd, chunk_size_ - HEAD_SIZE);
+#endif // ZDEBUG_UNINIT_MEMORY
+            free_id = next_id;
+        }
+        free_id_ = free_id;
+        used_count_ += exploited;
+        return exploited;
+    }
+
+    //back chunks by chunk id in one pass, the last id will be the head of free list.    
+    inline s32 back_n(const s32* ids, s32 count)
+    {
+        if (ids == nullptr)
+        {
+            return -1;
+        }
+        s32 free_id = free_id_;
+        for (s32 i = 0; i < count; i++)
+        {
+            chunk* c = ref(ids[i]);
+            c->head_ = HEAD_UNUSED;
+            c->free_id_ = free_id;
+            free_id = ids[i];
+            if (has_bitmap())
+            {
+                unset_used_bit(ids[i]);
+            }
+#ifdef ZDEBUG_DEATH_MEMORY
+            memset(&c->data_, 0xfd, chunk_size_ - HEAD_SIZE);
+#endif // ZDEBUG_DEATH_MEMORY
+        }
+        free_id_ = free_id;
+        used_count_ -= count;
+        return 0;
+    }
+
+    template<class _Ty, class... Args >
+    inline s32 create_n(s32 count, s32* out_ids, Args&&... args)
+    {
+        s32 created = exploit_n(count, out_ids);
+        if (!std::is_trivial<_Ty>::value || sizeof...(Args) > 0)
+        {
+            for (s32 i = 0; i < created; i++)
+            {
+                new (at(out_ids[i])) _Ty(args ...);
+            }
+        }
+        return created;
+    }
+
+    template<class _Ty>
+    inline s32 destroy_n(const s32* ids, s32 count)
+    {
+        if (ids == nullptr)
+        {
+            return -1;
+        }
+        if (!std::is_trivially_destructible<_Ty>::value)
+        {
+            for (s32 i = 0; i < count; i++)
+            {
+                reinterpret_cast<_Ty*>(at(ids[i]))->~_Ty();
+            }
+        }
+        return back_n(ids, count);
+    }
+
     template<class _Ty>
     inline _Ty* create_without_construct()
     {
@@ -363,13 +636,13 @@ public:
     template<class _Ty>
     inline void destroy(const typename std::enable_if <std::is_trivial<_Ty>::value, _Ty>::type* obj)
     {
-        back(obj);
+        back(const_cast<_Ty*>(obj));
     }
     template<class _Ty>
     inline void destroy(const typename std::enable_if <!std::is_trivial<_Ty>::value, _Ty>::type* obj)
     {
         obj->~_Ty();
-        back(obj);
+        back(const_cast<_Ty*>(obj));
     }
 };
 
@@ -0,0 +1,212 @@
+/*
+* Copyright (C) 2019 YaweiZhang <yawei.zhang@foxmail.com>.
+* All rights reserved
+* This file is part of the zbase, used MIT License.
+*/
+
+
+#pragma once
+#ifndef ZMPSC_RING_H
+#define ZMPSC_RING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <cstddef>
+
+#ifndef ZBASE_SHORT_TYPE
+#define ZBASE_SHORT_TYPE
+using s8 =  int8_t;
+using u8 =  uint8_t;
+using s16 = int16_t;
+using u16 = uint16_t;
+using s32 = int32_t;
+using u32 = uint32_t;
+using s64 = int64_t;
+using u64 = uint64_t;
+using f32 = float;
+using f64 = double;
+#endif
+
+
+/* type_traits:
+*
+* is_trivially_copyable: no (atomic index)
+    * memset: yes (only in init)
+    * memcpy: no
+* shm resume : safely, require slots space address fixed. call recover() before producers start.
+    * has vptr:     no
+    * static var:   no
+    * has heap ptr: yes (slots space)
+    * has code ptr: no
+* thread safe: multi producer (push), single consumer (drain)
+*
+*/
+
+
+/*
+* bounded lock-free multi-producer single-consumer ring of fixed size slots.
+* write_idx_ / read_idx_ are on their own cache lines (like fn-log RingBuffer).
+* every slot has a sequence: producer claims a slot by cas on write_idx_, fills it and publishes it by seq = pos + 1,
+* the consumer reads in order and frees the slot by seq = pos + slot_count.
+* a producer is never blocked by a slower producer, the consumer only waits the oldest slot.
+*/
+class zmpsc_ring
+{
+public:
+    static constexpr u32 CACHE_LINE = 64;
+    static constexpr u32 DROPPED = 0xffffffff; //len of a claimed slot which never published (producer died)
+
+    struct slot
+    {
+        std::atomic<u64> seq_;
+        u32 type_;
+        u32 len_;
+        char data_[1];
+    };
+    static constexpr u32 SLOT_HEAD = offsetof(slot, data_);
+
+    static constexpr u64 align_line(u64 bytes) { return (bytes + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE; }
+    static constexpr s64 calculate_space_size(u32 payload_size, u32 slot_count) { return (s64)align_line(SLOT_HEAD + payload_size) * slot_count; }
+
+    //slot_count must be power of 2.
+    inline s32 init(u32 payload_size, u32 slot_count, void* space, s64 space_size)
+    {
+        if (slot_count == 0 || (slot_count & (slot_count - 1)) != 0 || payload_size == 0)
+        {
+            return -1;
+        }
+        if (space == nullptr || space_size < calculate_space_size(payload_size, slot_count))
+        {
+            return -2;
+        }
+        write_idx_.store(0, std::memory_order_relaxed);
+        read_idx_.store(0, std::memory_order_relaxed);
+        full_count_.store(0, std::memory_order_relaxed);
+        payload_size_ = payload_size;
+        slot_size_ = (u32)align_line(SLOT_HEAD + payload_size);
+        slot_count_ = slot_count;
+        space_ = (char*)space;
+        for (u32 i = 0; i < slot_count_; i++)
+        {
+            ref(i)->seq_.store(i, std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        return 0;
+    }
+
+    /*
+    * after resume, before any producer: slots claimed but never published by the dead process are marked dropped,
+    * so drain can pass them. published slots are kept.
+    * return dropped count.
+    */
+    inline u32 recover()
+    {
+        u32 dropped = 0;
+        u64 end = write_idx_.load(std::memory_order_relaxed);
+        for (u64 pos = read_idx_.load(std::memory_order_relaxed); pos < end; pos++)
+        {
+            slot* s = ref(pos);
+            if (s->seq_.load(std::memory_order_relaxed) != pos + 1)
+            {
+                s->len_ = DROPPED;
+                s->seq_.store(pos + 1, std::memory_order_relaxed);
+                dropped++;
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        return dropped;
+    }
+
+    inline u32 payload_size() const { return payload_size_; }
+    inline u32 capacity() const { return slot_count_; }
+    //not exact when producers are pushing.
+    inline u64 size() const { return write_idx_.load(std::memory_order_relaxed) - read_idx_.load(std::memory_order_relaxed); }
+    inline bool empty() const { return size() == 0; }
+    inline u64 full_count() const { return full_count_.load(std::memory_order_relaxed); }
+
+    //any thread. 0 success, -1 full, -2 too large
+    inline s32 push(u32 type, const void* data, u32 len)
+    {
+        if (len > payload_size_)
+        {
+            return -2;
+        }
+        u64 pos = write_idx_.load(std::memory_order_relaxed);
+        slot* s = nullptr;
+        while (true)
+        {
+            s = ref(pos);
+            u64 seq = s->seq_.load(std::memory_order_acquire);
+            s64 diff = (s64)(seq - pos);
+            if (diff == 0)
+            {
+                if (write_idx_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                full_count_.fetch_add(1, std::memory_order_relaxed);
+                return -1;
+            }
+            else
+            {
+                pos = write_idx_.load(std::memory_order_relaxed);
+            }
+        }
+        s->type_ = type;
+        s->len_ = len;
+        if (len > 0)
+        {
+            memcpy(s->data_, data, len);
+        }
+        s->seq_.store(pos + 1, std::memory_order_release);
+        return 0;
+    }
+
+    /*
+    * consumer thread only. fn(type, data, len) for at most max_count published commands in push order.
+    * stop at the first slot still being filled. return drained count (dropped slots not counted).
+    */
+    template<class Fn>
+    inline u32 drain(u32 max_count, Fn&& fn)
+    {
+        u32 count = 0;
+        u64 pos = read_idx_.load(std::memory_order_relaxed);
+        while (count < max_count)
+        {
+            slot* s = ref(pos);
+            if (s->seq_.load(std::memory_order_acquire) != pos + 1)
+            {
+                break;
+            }
+            if (s->len_ != DROPPED)
+            {
+                fn(s->type_, (const char*)s->data_, s->len_);
+                count++;
+            }
+            s->seq_.store(pos + slot_count_, std::memory_order_release);
+            pos++;
+            read_idx_.store(pos, std::memory_order_relaxed);
+        }
+        return count;
+    }
+
+private:
+    inline slot* ref(u64 pos) const { return reinterpret_cast<slot*>(space_ + (u64)slot_size_ * (pos & (slot_count_ - 1))); }
+
+private:
+    alignas(CACHE_LINE) std::atomic<u64> write_idx_;
+    alignas(CACHE_LINE) std::atomic<u64> read_idx_;
+    alignas(CACHE_LINE) std::atomic<u64> full_count_;
+    u32 payload_size_;
+    u32 slot_size_;
+    u32 slot_count_;
+    char* space_;
+};
+
+
+
+#endif
@@ -12,6 +12,9 @@
 #include <stdint.h>
 #include "zshm_loader.h"
 #include "zarray.h"
+#include "zfile.h"
+#include "zfile_mapping.h"
+#include <unordered_map>
 
 
 #ifndef ZBASE_SHORT_TYPE
@@ -56,10 +59,208 @@ struct zshm_space
     u64 shm_key_; //shared memory key   
     u64 use_heap_ : 1; //create by heap  
     u64 use_fixed_ : 1; //used fixed address  
+    u64 use_huge_page_ : 1; //try huge page first, fallback to normal page when no huge page reserved  
+    u64 page_size_; //page size of the real mapping, fill by build/resume  
+    u64 frame_seq_; //1 when build, +1 when switch to a shadow frame. 0: shadow frame not ready  
+    u64 tick_epoch_; //seqlock of the owner tick: odd while ticking. observers retry their read when it changed  
     zshm_sub whole_;        
     std::array<zshm_sub, ZSHM_MAX_SPACES> subs_;
 };
 
+//snapshot file: head + data of every sub.  
+struct zshm_snapshot_head
+{
+    static constexpr u64 MAGIC = 0x7a73686d736e6170ULL;
+    u64 magic_;
+    u64 data_size_[ZSHM_MAX_SPACES]; //stored bytes from the begin of sub, the tail is zero when restore   
+    zshm_space space_; //subs_ hash_ is the checksum of stored bytes   
+};
+
+//delta file: head + offsets of blocks + data of blocks. only valid on the base which hash is base_hash_.  
+struct zshm_delta_head
+{
+    static constexpr u64 MAGIC = 0x7a73686d64656c74ULL;
+    u64 magic_;
+    u64 seq_; //1,2,3... after base   
+    u64 base_hash_; //hash of base snapshot head  
+    u64 block_size_;
+    u64 block_count_;
+    u64 hash_; //checksum of offsets and data  
+    u64 data_size_[ZSHM_MAX_SPACES]; //stored bytes of every sub at this checkpoint  
+};
+
+
+/*
+* dirty blocks of a frame since last reset.
+* use soft dirty bits (/proc/self/clear_refs + pagemap) when kernel support it, else compare the hash of every block.
+* soft dirty limits:
+*   clear_refs resets the bits of the whole process: one tracker per process, and no other soft dirty user in it.
+*   a page written by another thread after its pagemap entry is read and before the clear is lost for the next delta.
+*   collect must be called when no other thread writes the frame (between ticks). subs written outside the tick
+*   (lock free rings filled by other threads) are passed in always_subs and stored whole every time.
+*/
+class zshm_dirty_tracker
+{
+public:
+    u64 block_size() const { return block_size_; }
+    bool use_soft_dirty() const { return use_soft_dirty_; }
+
+    s32 reset(const zshm_space& entry, const u64* data_size)
+    {
+        block_size_ = (u64)zshm_loader_impl::normal_page_size();
+        use_soft_dirty_ = soft_dirty_supported();
+        hashes_.clear();
+        if (use_soft_dirty_)
+        {
+            return clear_soft_dirty() ? 0 : zshm_errno::E_INVALID_PARAM;
+        }
+        std::vector<u64> blocks;
+        return collect_by_hash(entry, data_size, blocks);
+    }
+
+    //offsets (from frame begin) of dirty blocks in stored bytes of every sub, then reset.   
+    //always_subs: bit mask of subs which all blocks are taken as dirty.
+    s32 collect(const zshm_space& entry, const u64* data_size, std::vector<u64>& blocks, u64 always_subs = 0)
+    {
+        blocks.clear();
+        if (block_size_ == 0)
+        {
+            return zshm_errno::E_NO_INIT;
+        }
+        for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+        {
+            if ((always_subs >> i) & 1)
+            {
+                u64 end = entry.subs_[i].offset_ + std::min(data_size[i], entry.subs_[i].size_);
+                for (u64 block = entry.subs_[i].offset_ / block_size_ * block_size_; block < end; block += block_size_)
+                {
+                    blocks.push_back(block);
+                }
+            }
+        }
+        if (!use_soft_dirty_)
+        {
+            s32 ret = collect_by_hash(entry, data_size, blocks);
+            std::sort(blocks.begin(), blocks.end());
+            blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+            return ret;
+        }
+#ifdef __linux__
+        //a block may cross two subs  
+        struct unique_guard
+        {
+            std::vector<u64>& blocks_;
+            ~unique_guard()
+            {
+                std::sort(blocks_.begin(), blocks_.end());
+                blocks_.erase(std::unique(blocks_.begin(), blocks_.end()), blocks_.end());
+            }
+        } guard{ blocks };
+        int fd = open("/proc/self/pagemap", O_RDONLY);
+        if (fd < 0)
+        {
+            return zshm_errno::E_READ_FILE_FAILED;
+        }
+        std::vector<u64> pagemap;
+        for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+        {
+            u64 begin = entry.subs_[i].offset_ / block_size_;
+            u64 end = (entry.subs_[i].offset_ + std::min(data_size[i], entry.subs_[i].size_) + block_size_ - 1) / block_size_;
+            if (begin >= end)
+            {
+                continue;
+            }
+            u64 first_page = entry.fixed_ / block_size_;
+            pagemap.resize(end - begin);
+            ssize_t bytes = (ssize_t)(pagemap.size() * sizeof(u64));
+            if (pread(fd, pagemap.data(), bytes, (off_t)((first_page + begin) * sizeof(u64))) != bytes)
+            {
+                ::close(fd);
+                return zshm_errno::E_READ_FILE_FAILED;
+            }
+            for (u64 j = 0; j < pagemap.size(); j++)
+            {
+                //bit 55: soft dirty  
+                if ((pagemap[j] >> 55) & 1)
+                {
+                    blocks.push_back((begin + j) * block_size_);
+                }
+            }
+        }
+        ::close(fd);
+        return clear_soft_dirty() ? 0 : zshm_errno::E_INVALID_PARAM;
+#else
+        return zshm_errno::E_INVALID_PARAM;
+#endif
+    }
+
+    static bool soft_dirty_supported()
+    {
+#ifdef __linux__
+        static const bool supported = []()
+        {
+            u64 page_size = (u64)zshm_loader_impl::normal_page_size();
+            volatile char* probe = (volatile char*)mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (probe == MAP_FAILED)
+            {
+                return false;
+            }
+            probe[0] = 1;
+            bool ret = clear_soft_dirty() && !read_soft_dirty((u64)probe);
+            probe[0] = 2;
+            ret = ret && read_soft_dirty((u64)probe);
+            munmap((void*)probe, page_size);
+            return ret;
+        }();
+        return supported;
+#else
+        return false;
+#endif
+    }
+
+private:
+    static bool clear_soft_dirty()
+    {
+#ifdef __linux__
+        int fd = open("/proc/self/clear_refs", O_WRONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        bool ret = ::write(fd, "4", 1) == 1;
+        ::close(fd);
+        return ret;
+#else
+        return false;
+#endif
+    }
+
+    static bool read_soft_dirty(u64 addr)
+    {
+#ifdef __linux__
+        int fd = open("/proc/self/pagemap", O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        u64 entry = 0;
+        u64 page_size = (u64)zshm_loader_impl::normal_page_size();
+        bool ret = pread(fd, &entry, sizeof(entry), (off_t)(addr / page_size * sizeof(entry))) == sizeof(entry);
+        ::close(fd);
+        return ret && ((entry >> 55) & 1);
+#else
+        return false;
+#endif
+    }
+
+    s32 collect_by_hash(const zshm_space& entry, const u64* data_size, std::vector<u64>& blocks);
+
+private:
+    u64 block_size_ = 0;
+    bool use_soft_dirty_ = false;
+    std::vector<u64> hashes_; //hash of every block, index is frame offset / block size  
+};
+
 
 
 
@@ -73,7 +274,7 @@ public:
     static s32 build_frame(const zshm_space& params, zshm_space*& entry)
     {
         entry = nullptr;
-        zshm_loader loader(params.use_heap_, params.shm_key_, params.whole_.size_);
+        zshm_loader loader(params.use_heap_, params.shm_key_, params.whole_.size_, params.use_huge_page_);
         s32 ret = loader.check();
         if (ret != zshm_errno::E_NO_SHM_MAPPING)
         {
@@ -91,11 +292,30 @@ public:
         memcpy(loader.shm_mnt_addr(), &params, sizeof(params));
         entry = static_cast<zshm_space*>(loader.shm_mnt_addr());
         entry->fixed_ = (u64)(loader.shm_mnt_addr());
+        entry->page_size_ = (u64)loader.shm_page_size();
+        entry->frame_seq_ = 1;
 
         return 0;
     }
 
     static s32 resume_frame(const zshm_space& params, zshm_space*& entry)
+    {
+        s32 ret = attach_frame(params, entry);
+        if (ret != 0)
+        {
+            return ret;
+        }
+        ret = check_frame(params, *entry);
+        if (ret != 0)
+        {
+            entry = nullptr;
+            return ret;
+        }
+        return 0;
+    }
+
+    //attach exist frame without version check. the layout of entry maybe different from params.  
+    static s32 attach_frame(const zshm_space& params, zshm_space*& entry)
     {
         entry = nullptr;
         zshm_loader loader(params.use_heap_, params.shm_key_, params.whole_.size_);
@@ -112,31 +332,714 @@ public:
 
         entry = static_cast<zshm_space*>(loader.shm_mnt_addr());
         entry->fixed_ = (u64)(loader.shm_mnt_addr());
+        entry->page_size_ = (u64)loader.shm_page_size();
+        return 0;
+    }
+
+    //attach exist frame read only (observer process). it must be mapped at the address it was built, nothing is written.  
+    static s32 observe_frame(const zshm_space& params, const zshm_space*& entry)
+    {
+        entry = nullptr;
+        zshm_loader loader(params.use_heap_, params.shm_key_, params.whole_.size_);
+        s32 ret = loader.check();
+        if (ret != 0)
+        {
+            return ret;
+        }
+        ret = loader.attach(params.fixed_, true);
+        if (ret != 0)
+        {
+            return ret;
+        }
+        const zshm_space* space = static_cast<const zshm_space*>(loader.shm_mnt_addr());
+        if (space->fixed_ != (u64)space)
+        {
+            loader.detach();
+            return zshm_errno::E_ATTACH_SHM_MAPPING_FAILED;
+        }
+        entry = space;
+        return 0;
+    }
 
+    static s32 check_frame(const zshm_space& params, const zshm_space& entry)
+    {
         //check version  
-        if (memcmp(&entry->whole_, &params.whole_, sizeof(params.whole_)) != 0)
+        if (memcmp(&entry.whole_, &params.whole_, sizeof(params.whole_)) != 0)
         {
-            entry = nullptr;
             return zshm_errno::E_SHM_VERSION_MISMATCH;
         }
-        if (memcmp(&entry->subs_, &params.subs_, sizeof(params.subs_)) != 0)
+        if (memcmp(&entry.subs_, &params.subs_, sizeof(params.subs_)) != 0)
         {
-            entry = nullptr;
             return zshm_errno::E_SHM_VERSION_MISMATCH;
         }
-
         return 0;
     }
 
     static s32 destroy_frame(const zshm_space& params)
     {
-        return zshm_loader::external_destroy(params.shm_key_, params.use_heap_, (void*)params.fixed_, params.whole_.size_);
+        return zshm_loader::external_destroy(params.shm_key_, params.use_heap_, (void*)params.fixed_, map_size(params));
+    }
+
+    //only detach, the shm is kept.  
+    static s32 detach_frame(const zshm_space& entry)
+    {
+        return zshm_loader::external_detach(entry.use_heap_, (void*)entry.fixed_, map_size(entry));
+    }
+
+    //the key of an attached frame maybe switched to a newer frame (shadow resume). 
+    static bool own_key(const zshm_space& entry)
+    {
+        if (entry.use_heap_)
+        {
+            return true;
+        }
+        zshm_loader loader(false, entry.shm_key_, 0);
+        if (loader.check() != 0)
+        {
+            return false;
+        }
+        if (loader.attach(0) != 0)
+        {
+            return true;
+        }
+        bool own = ((const zshm_space*)loader.shm_mnt_addr())->frame_seq_ == entry.frame_seq_;
+        loader.detach();
+        return own;
+    }
+
+    //the real page size of one sub space.  
+    static s64 sub_page_size(const zshm_space& space, u32 sub_id)
+    {
+        if (sub_id >= ZSHM_MAX_SPACES || space.subs_[sub_id].size_ == 0)
+        {
+            return 0;
+        }
+        return zshm_loader::query_page_size((const char*)space.fixed_ + space.subs_[sub_id].offset_);
+    }
+
+    //touch every page of one sub space to avoid page fault at runtime.  
+    //region larger than prefault_split_size() is split to max_threads threads.  
+    static s32 prefault_sub(const zshm_space& space, u32 sub_id, s32 max_threads)
+    {
+        if (sub_id >= ZSHM_MAX_SPACES || space.fixed_ == 0)
+        {
+            return zshm_errno::E_INVALID_PARAM;
+        }
+        const zshm_sub& sub = space.subs_[sub_id];
+        if (sub.size_ == 0)
+        {
+            return 0;
+        }
+        u64 page_size = space.page_size_ > 0 ? space.page_size_ : (u64)zshm_loader_impl::normal_page_size();
+        u64 begin = (space.fixed_ + sub.offset_) / page_size * page_size;
+        u64 end = (space.fixed_ + sub.offset_ + sub.size_ + page_size - 1) / page_size * page_size;
+        u64 pages = (end - begin) / page_size;
+
+        u64 threads = 1;
+        if (max_threads > 1 && end - begin > prefault_split_size())
+        {
+            threads = (end - begin) / prefault_split_size();
+            threads = threads < (u64)max_threads ? threads : (u64)max_threads;
+        }
+        if (threads <= 1)
+        {
+            return prefault_range(begin, end, page_size);
+        }
+
+        std::atomic<s32> error(0);
+        std::vector<std::thread> workers;
+        u64 step = (pages + threads - 1) / threads * page_size;
+        for (u64 range_begin = begin; range_begin < end; range_begin += step)
+        {
+            u64 range_end = range_begin + step < end ? range_begin + step : end;
+            workers.emplace_back([range_begin, range_end, page_size, &error]()
+                {
+                    s32 ret = prefault_range(range_begin, range_end, page_size);
+                    if (ret != 0)
+                    {
+                        error = ret;
+                    }
+                });
+        }
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+        return error;
+    }
+
+    //bind one sub space to numa node. call it before prefault, touched pages will be moved.   
+    static s32 bind_sub_numa(const zshm_space& space, u32 sub_id, s32 node)
+    {
+        if (sub_id >= ZSHM_MAX_SPACES || space.fixed_ == 0 || node < 0 || node >= 64)
+        {
+            return zshm_errno::E_INVALID_PARAM;
+        }
+        const zshm_sub& sub = space.subs_[sub_id];
+        if (sub.size_ == 0)
+        {
+            return 0;
+        }
+#if defined(__linux__) && defined(SYS_mbind)
+        constexpr static s32 kMpolBind = 2;
+        constexpr static u32 kMpolMfMove = 1 << 1;
+        u64 page_size = space.page_size_ > 0 ? space.page_size_ : (u64)zshm_loader_impl::normal_page_size();
+        u64 begin = (space.fixed_ + sub.offset_) / page_size * page_size;
+        u64 end = (space.fixed_ + sub.offset_ + sub.size_ + page_size - 1) / page_size * page_size;
+        unsigned long node_mask = 1UL << node;
+        long ret = syscall(SYS_mbind, begin, end - begin, kMpolBind, &node_mask, sizeof(node_mask) * 8, kMpolMfMove);
+        if (ret != 0)
+        {
+            return zshm_errno::E_NUMA_BIND_FAILED;
+        }
+        return 0;
+#else
+        return zshm_errno::E_NUMA_BIND_FAILED;
+#endif
+    }
+
+    static constexpr u64 prefault_split_size() { return 64ULL * 1024 * 1024; }
+
+    //hash_data of len bytes fed in pieces. every piece but the last must be a multiple of 8 bytes.
+    struct hash_stream
+    {
+        u64 h_;
+        explicit hash_stream(u64 len) : h_(0xcbf29ce484222325ULL ^ len) {}
+        void update(const char* data, u64 len)
+        {
+            u64 i = 0;
+            for (; i + 8 <= len; i += 8)
+            {
+                u64 w;
+                memcpy(&w, data + i, sizeof(w));
+                h_ ^= w * 0x9e3779b97f4a7c15ULL;
+                h_ = ((h_ << 31) | (h_ >> 33)) * 0xff51afd7ed558ccdULL;
+            }
+            for (; i < len; i++)
+            {
+                h_ ^= (u8)data[i];
+                h_ *= 0x100000001b3ULL;
+            }
+        }
+    };
+
+    //checksum of sub space data, not a crypto hash.
+    static u64 hash_data(const char* data, u64 len)
+    {
+        hash_stream stream(len);
+        stream.update(data, len);
+        return stream.h_;
+    }
+
+    //write frame to file. data_size: bytes need save of every sub. the header in shm is not changed.   
+    //head_hash: the id of this base, deltas are bound to it.   
+    static s32 snapshot_frame(const zshm_space& entry, const u64* data_size, const char* path, u64* head_hash = nullptr)
+    {
+        if (entry.fixed_ == 0 || data_size == nullptr || path == nullptr)
+        {
+            return zshm_errno::E_INVALID_PARAM;
+        }
+        zshm_snapshot_head head;
+        memset(&head, 0, sizeof(head));
+        head.magic_ = zshm_snapshot_head::MAGIC;
+        head.space_ = entry;
+        for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+        {
+            const char* data = (const char*)entry.fixed_ + entry.subs_[i].offset_;
+            head.data_size_[i] = std::min(data_size[i], entry.subs_[i].size_);
+            head.space_.subs_[i].hash_ = hash_data(data, head.data_size_[i]);
+        }
+
+        //write to temp file then rename, an old snapshot is not broken by a failed write.  
+        std::string tmp_path = std::string(path) + ".tmp";
+        zfile file;
+        struct stat file_stat;
+        if (file.open(tmp_path.c_str(), "wb", file_stat) < 0)
+        {
+            return zshm_errno::E_CREATE_FILE_FAILED;
+        }
+        file.write((const char*)&head, sizeof(head));
+        for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+        {
+            file.write((const char*)entry.fixed_ + entry.subs_[i].offset_, head.data_size_[i]);
+        }
+        s32 ret = commit_file(file, tmp_path, path);
+        if (ret != 0)
+        {
+            return ret;
+        }
+        if (head_hash != nullptr)
+        {
+            *head_hash = hash_data((const char*)&head, sizeof(head));
+        }
+        return 0;
+    }
+
+    static std::string delta_path(const char* path, u64 seq)
+    {
+        return std::string(path) + ".delta." + std::to_string(seq);
+    }
+
+    //remove delta files from seq until the first not exist one.  
+    static void remove_deltas(const char* path, u64 seq = 1)
+    {
+        while (zfile::remove_file(delta_path(path, seq++)))
+        {
+        }
+    }
+
+    //write dirty blocks of frame to the delta file seq of base.  
+    static s32 snapshot_delta(const zshm_space& entry, const u64* data_size, const std::vector<u64>& blocks, u64 block_size,
+        const char* path, u64 base_hash, u64 seq)
+    {
+        if (entry.fixed_ == 0 || data_size == nullptr || path == nullptr || block_size == 0)
+        {
+            return zshm_errno::E_INVALID_PARAM;
+        }
+        zshm_delta_head head;
+        memset(&head, 0, sizeof(head));
+        head.magic_ = zshm_delta_head::MAGIC;
+        head.seq_ = seq;
+        head.base_hash_ = base_hash;
+        head.block_size_ = block_size;
+        head.block_count_ = blocks.size();
+        for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+        {
+            head.data_size_[i] = std::min(data_size[i], entry.subs_[i].size_);
+        }
+        head.hash_ = hash_data((const char*)blocks.data(), blocks.size() * sizeof(u64));
+        for (u64 offset : blocks)
+        {
+            head.hash_ ^= hash_data((const char*)entry.fixed_ + offset, block_len(entry, offset, block_size));
+        }
+
+        std::string file_path = delta_path(path, seq);
+        std::string tmp_path = file_path + ".tmp";
+        zfile file;
+        struct stat file_stat;
+        if (file.open(tmp_path.c_str(), "wb", file_stat) < 0)
+        {
+            return zshm_errno::E_CREATE_FILE_FAILED;
+        }
+        file.write((const char*)&head, sizeof(head));
+        file.write((const char*)blocks.data(), blocks.size() * sizeof(u64));
+        for (u64 offset : blocks)
+        {
+            file.write((const char*)entry.fixed_ + offset, block_len(entry, offset, block_size));
+        }
+        return commit_file(file, tmp_path, file_path);
+    }
+
+    //apply deltas of base to frame in order, stop at the first not exist or not belong to base.   
+    //data_size: max stored bytes of every sub after applied.   
+    static s32 apply_deltas(const zshm_space& entry, const char* path, u64 base_hash, u64* data_size, u64& applied)
+    {
+        applied = 0;
+        for (u64 seq = 1; ; seq++)
+        {
+            zfile_mapping mapping;
+            zshm_delta_head head;
+            bool found = false;
+            s32 ret = open_delta(entry, path, base_hash, seq, mapping, head, found);
+            if (ret != 0 || !found)
+            {
+                return ret;
+            }
+            const u64* offsets = (const u64*)(mapping.file_data() + sizeof(head));
+            const char* data = mapping.file_data() + sizeof(head) + head.block_count_ * sizeof(u64);
+            for (u64 i = 0; i < head.block_count_; i++)
+            {
+                u64 len = block_len(entry, offsets[i], head.block_size_);
+                memcpy((char*)entry.fixed_ + offsets[i], data, len);
+                data += len;
+            }
+            for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+            {
+                data_size[i] = std::max(data_size[i], std::min(head.data_size_[i], entry.subs_[i].size_));
+            }
+            applied++;
+        }
+        return 0;
+    }
+
+    /*
+    * merge base and deltas to a new base, then remove deltas.
+    * streamed: every block of the new base is read from the last delta which has it, else from the base file,
+    * no image of the frame in memory. only the mapped files and an index of the delta blocks.
+    */
+    static s32 compact_snapshot(const zshm_space& params, const char* path, u64* head_hash = nullptr)
+    {
+        zfile_mapping base;
+        zshm_snapshot_head base_head;
+        s32 ret = open_snapshot(params, path, base, base_head);
+        if (ret != 0)
+        {
+            return ret;
+        }
+        u64 base_hash = hash_data((const char*)&base_head, sizeof(base_head));
+        const char* base_data[ZSHM_MAX_SPACES];
+        const char* data = base.file_data() + sizeof(base_head);
+        u64 data_size[ZSHM_MAX_SPACES];
+        for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+        {
+            if (hash_data(data, base_head.data_size_[i]) != base_head.space_.subs_[i].hash_)
+            {
+                return zshm_errno::E_FILE_CHECKSUM_MISMATCH;
+            }
+            base_data[i] = data;
+            data_size[i] = base_head.data_size_[i];
+            data += base_head.data_size_[i];
+        }
+
+        //frame offset of block -> data in the newest delta
+        u64 block_size = (u64)zshm_loader_impl::normal_page_size();
+        std::vector<std::unique_ptr<zfile_mapping>> deltas;
+        std::unordered_map<u64, const char*> newest;
+        for (u64 seq = 1; ; seq++)
+        {
+            std::unique_ptr<zfile_mapping> mapping(new zfile_mapping());
+            zshm_delta_head head;
+            bool found = false;
+            ret = open_delta(params, path, base_hash, seq, *mapping, head, found);
+            if (ret != 0)
+            {
+                return ret;
+            }
+            if (!found)
+            {
+                break;
+            }
+            if (deltas.empty())
+            {
+                block_size = head.block_size_;
+            }
+            if (head.block_size_ != block_size)
+            {
+                return zshm_errno::E_READ_FILE_FAILED;
+            }
+            const u64* offsets = (const u64*)(mapping->file_data() + sizeof(head));
+            const char* block_data = mapping->file_data() + sizeof(head) + head.block_count_ * sizeof(u64);
+            for (u64 i = 0; i < head.block_count_; i++)
+            {
+                if (offsets[i] % block_size != 0)
+                {
+                    return zshm_errno::E_READ_FILE_FAILED;
+                }
+                newest[offsets[i]] = block_data;
+                block_data += block_len(params, offsets[i], block_size);
+            }
+            for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+            {
+                data_size[i] = std::max(data_size[i], std::min(head.data_size_[i], params.subs_[i].size_));
+            }
+            deltas.push_back(std::move(mapping));
+        }
+
+        zshm_snapshot_head head;
+        memset(&head, 0, sizeof(head));
+        head.magic_ = zshm_snapshot_head::MAGIC;
+        head.space_ = base_head.space_;
+        std::string tmp_path = std::string(path) + ".tmp";
+        zfile file;
+        struct stat file_stat;
+        if (file.open(tmp_path.c_str(), "wb", file_stat) < 0)
+        {
+            return zshm_errno::E_CREATE_FILE_FAILED;
+        }
+        //head is written again with the hashes at the end.
+        file.write((const char*)&head, sizeof(head));
+        std::vector<char> zeros(block_size, 0);
+        for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+        {
+            u64 sub_begin = params.subs_[i].offset_;
+            hash_stream hash(data_size[i]);
+            for (u64 pos = 0; pos < data_size[i]; )
+            {
+                //pieces end at block bounds of frame. sub offsets are 16 bytes aligned, so pieces keep the 8 bytes rule of hash_stream.
+                u64 block = (sub_begin + pos) / block_size * block_size;
+                u64 len = std::min(block + block_size - sub_begin, data_size[i]) - pos;
+                const char* piece = nullptr;
+                auto founder = newest.find(block);
+                if (founder != newest.end())
+                {
+                    piece = founder->second + (sub_begin + pos - block);
+                }
+                else if (pos < base_head.data_size_[i])
+                {
+                    len = std::min(len, base_head.data_size_[i] - pos);
+                    piece = base_data[i] + pos;
+                }
+                else
+                {
+                    piece = zeros.data();
+                }
+                hash.update(piece, len);
+                file.write(piece, len);
+                pos += len;
+            }
+            head.data_size_[i] = data_size[i];
+            head.space_.subs_[i].hash_ = hash.h_;
+        }
+        if (file.is_open() && fseek(file.file_, 0, SEEK_SET) != 0)
+        {
+            file.close();
+        }
+        file.write((const char*)&head, sizeof(head));
+        ret = commit_file(file, tmp_path, path);
+        if (ret != 0)
+        {
+            return ret;
+        }
+        if (head_hash != nullptr)
+        {
+            *head_hash = hash_data((const char*)&head, sizeof(head));
+        }
+        remove_deltas(path);
+        return 0;
+    }
+
+    //build a new frame from snapshot file and its deltas. file layout must same as params.  
+    static s32 restore_frame(const zshm_space& params, const char* path, zshm_space*& entry)
+    {
+        entry = nullptr;
+        s32 ret = build_frame(params, entry);
+        if (ret != 0)
+        {
+            return ret;
+        }
+        u64 base_hash = 0;
+        u64 data_size[ZSHM_MAX_SPACES];
+        u64 applied = 0;
+        ret = load_snapshot(*entry, path, base_hash, data_size);
+        if (ret == 0)
+        {
+            ret = apply_deltas(*entry, path, base_hash, data_size, applied);
+        }
+        if (ret != 0)
+        {
+            destroy_frame(*entry);
+            entry = nullptr;
+            return ret;
+        }
+        return 0;
+    }
+
+    //copy base snapshot to frame (the header of frame not changed).  
+    static s32 load_snapshot(const zshm_space& entry, const char* path, u64& base_hash, u64* data_size)
+    {
+        zfile_mapping mapping;
+        zshm_snapshot_head head;
+        s32 ret = open_snapshot(entry, path, mapping, head);
+        if (ret != 0)
+        {
+            return ret;
+        }
+        base_hash = hash_data((const char*)&head, sizeof(head));
+        const char* data = mapping.file_data() + sizeof(head);
+        for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+        {
+            if (hash_data(data, head.data_size_[i]) != head.space_.subs_[i].hash_)
+            {
+                return zshm_errno::E_FILE_CHECKSUM_MISMATCH;
+            }
+            memcpy((char*)entry.fixed_ + entry.subs_[i].offset_, data, head.data_size_[i]);
+            data_size[i] = head.data_size_[i];
+            data += head.data_size_[i];
+        }
+        return 0;
     }
 
 private:
+    //map a base snapshot and check its size and layout. data hashes are checked by the reader.
+    static s32 open_snapshot(const zshm_space& entry, const char* path, zfile_mapping& mapping, zshm_snapshot_head& head)
+    {
+        if (path == nullptr || mapping.mapping_res(path, true) != 0)
+        {
+            return zshm_errno::E_READ_FILE_FAILED;
+        }
+        if (mapping.file_size() < (s64)sizeof(zshm_snapshot_head))
+        {
+            return zshm_errno::E_READ_FILE_FAILED;
+        }
+        memcpy(&head, mapping.file_data(), sizeof(head));
+        u64 file_size = sizeof(head);
+        for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+        {
+            if (head.data_size_[i] > head.space_.subs_[i].size_)
+            {
+                return zshm_errno::E_READ_FILE_FAILED;
+            }
+            file_size += head.data_size_[i];
+            head.space_.subs_[i].hash_ = entry.subs_[i].hash_;
+        }
+        if (head.magic_ != zshm_snapshot_head::MAGIC || file_size != (u64)mapping.file_size())
+        {
+            return zshm_errno::E_READ_FILE_FAILED;
+        }
+        s32 ret = check_frame(entry, head.space_);
+        if (ret != 0)
+        {
+            return ret;
+        }
+        memcpy(&head, mapping.file_data(), sizeof(head));
+        return 0;
+    }
+
+    //map delta seq of base and verify it. found is false when it not exist or belongs to an old base.
+    static s32 open_delta(const zshm_space& entry, const char* path, u64 base_hash, u64 seq, zfile_mapping& mapping, zshm_delta_head& head, bool& found)
+    {
+        found = false;
+        std::string file_path = delta_path(path, seq);
+        if (!zfile::is_file(file_path))
+        {
+            return 0;
+        }
+        if (mapping.mapping_res(file_path.c_str(), true) != 0 || mapping.file_size() < (s64)sizeof(zshm_delta_head))
+        {
+            return zshm_errno::E_READ_FILE_FAILED;
+        }
+        memcpy(&head, mapping.file_data(), sizeof(head));
+        if (head.magic_ != zshm_delta_head::MAGIC || head.base_hash_ != base_hash || head.seq_ != seq)
+        {
+            //stale delta of an old base
+            return 0;
+        }
+        if (head.block_size_ == 0 || (u64)mapping.file_size() < sizeof(head) + head.block_count_ * sizeof(u64))
+        {
+            return zshm_errno::E_READ_FILE_FAILED;
+        }
+        const u64* offsets = (const u64*)(mapping.file_data() + sizeof(head));
+        u64 file_size = sizeof(head) + head.block_count_ * sizeof(u64);
+        u64 hash = hash_data((const char*)offsets, head.block_count_ * sizeof(u64));
+        for (u64 i = 0; i < head.block_count_; i++)
+        {
+            if (offsets[i] >= entry.whole_.size_)
+            {
+                return zshm_errno::E_READ_FILE_FAILED;
+            }
+            u64 len = block_len(entry, offsets[i], head.block_size_);
+            if (file_size + len > (u64)mapping.file_size())
+            {
+                return zshm_errno::E_READ_FILE_FAILED;
+            }
+            hash ^= hash_data(mapping.file_data() + file_size, len);
+            file_size += len;
+        }
+        if (hash != head.hash_ || file_size != (u64)mapping.file_size())
+        {
+            return zshm_errno::E_FILE_CHECKSUM_MISMATCH;
+        }
+        found = true;
+        return 0;
+    }
+
+    /*
+    * durable replace of path by the written temp file: flush + fsync the data, check close, rename,
+    * then fsync the directory so the rename itself survives a crash. the temp file is removed on any error.
+    */
+    static s32 commit_file(zfile& file, const std::string& tmp_path, const std::string& path)
+    {
+        if (!file.is_open())
+        {
+            zfile::remove_file(tmp_path);
+            return zshm_errno::E_WRITE_FILE_FAILED;
+        }
+        FILE* fp = file.file_;
+        file.file_ = nullptr;
+        bool synced = fflush(fp) == 0;
+#ifdef WIN32
+        synced = synced && _commit(_fileno(fp)) == 0;
+#else
+        synced = synced && fsync(fileno(fp)) == 0;
+#endif
+        bool closed = fclose(fp) == 0;
+        if (!synced || !closed)
+        {
+            zfile::remove_file(tmp_path);
+            return zshm_errno::E_WRITE_FILE_FAILED;
+        }
+        if (::rename(tmp_path.c_str(), path.c_str()) != 0)
+        {
+            zfile::remove_file(tmp_path);
+            return zshm_errno::E_WRITE_FILE_FAILED;
+        }
+#ifndef WIN32
+        std::string dir = path.substr(0, path.find_last_of('/') == std::string::npos ? 0 : path.find_last_of('/') + 1);
+        int dir_fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+        if (dir_fd < 0)
+        {
+            return zshm_errno::E_WRITE_FILE_FAILED;
+        }
+        bool dir_synced = fsync(dir_fd) == 0;
+        ::close(dir_fd);
+        if (!dir_synced)
+        {
+            return zshm_errno::E_WRITE_FILE_FAILED;
+        }
+#endif
+        return 0;
+    }
+
+    //the last block of frame maybe not full   
+    static u64 block_len(const zshm_space& entry, u64 offset, u64 block_size)
+    {
+        return std::min(block_size, entry.whole_.size_ - offset);
+    }
 
+    static u64 map_size(const zshm_space& params)
+    {
+        u64 mem_size = params.whole_.size_;
+        if (params.page_size_ > 0)
+        {
+            //huge page mapping length is aligned to huge page size  
+            mem_size = (mem_size + params.page_size_ - 1) / params.page_size_ * params.page_size_;
+        }
+        return mem_size;
+    }
+
+    static s32 prefault_range(u64 begin, u64 end, u64 page_size)
+    {
+        if (begin >= end)
+        {
+            return 0;
+        }
+#if defined(__linux__) && defined(MADV_POPULATE_WRITE)
+        if (madvise((void*)begin, end - begin, MADV_POPULATE_WRITE) == 0)
+        {
+            return 0;
+        }
+        //old kernel: fallback to touch.  
+#endif
+        for (u64 addr = begin; addr < end; addr += page_size)
+        {
+            volatile char* p = (volatile char*)addr;
+            *p = *p;
+        }
+        return 0;
+    }
 };
 
 
+inline s32 zshm_dirty_tracker::collect_by_hash(const zshm_space& entry, const u64* data_size, std::vector<u64>& blocks)
+{
+    hashes_.resize((entry.whole_.size_ + block_size_ - 1) / block_size_, 0);
+    for (u32 i = 0; i < ZSHM_MAX_SPACES; i++)
+    {
+        u64 begin = entry.subs_[i].offset_ / block_size_;
+        u64 end = (entry.subs_[i].offset_ + std::min(data_size[i], entry.subs_[i].size_) + block_size_ - 1) / block_size_;
+        for (u64 block = begin; block < end; block++)
+        {
+            u64 offset = block * block_size_;
+            u64 hash = zshm_boot::hash_data((const char*)entry.fixed_ + offset, std::min(block_size_, entry.whole_.size_ - offset));
+            if (hash != hashes_[block])
+            {
+                hashes_[block] = hash;
+                blocks.push_back(offset);
+            }
+        }
+    }
+    return 0;
+}
+
 
 #endif
\ No newline at end of file
@@ -121,6 +121,10 @@ namespace zshm_errno
         E_CREATE_FILE_MAPPING_FAILED,
         E_ATTACH_FILE_MAPPING_FAILED,
         E_SHM_VERSION_MISMATCH,
+        E_NUMA_BIND_FAILED,
+        E_WRITE_FILE_FAILED,
+        E_READ_FILE_FAILED,
+        E_FILE_CHECKSUM_MISMATCH,
 
         E_MAX_ERROR,
     };
@@ -143,6 +147,10 @@ namespace zshm_errno
             ZSHM_ERRNO_TO_STRING(E_CREATE_FILE_MAPPING_FAILED);
             ZSHM_ERRNO_TO_STRING(E_ATTACH_FILE_MAPPING_FAILED);
             ZSHM_ERRNO_TO_STRING(E_SHM_VERSION_MISMATCH);
+            ZSHM_ERRNO_TO_STRING(E_NUMA_BIND_FAILED);
+            ZSHM_ERRNO_TO_STRING(E_WRITE_FILE_FAILED);
+            ZSHM_ERRNO_TO_STRING(E_READ_FILE_FAILED);
+            ZSHM_ERRNO_TO_STRING(E_FILE_CHECKSUM_MISMATCH);
         }
 
         return "unknown error";
@@ -151,6 +159,76 @@ namespace zshm_errno
 
 namespace zshm_loader_impl
 {
+    static inline s64 normal_page_size()
+    {
+#ifdef WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return (s64)info.dwPageSize;
+#else
+        return (s64)sysconf(_SC_PAGESIZE);
+#endif
+    }
+
+    //default huge page size of system;  linux: Hugepagesize in /proc/meminfo
+    static inline s64 huge_page_size()
+    {
+        s64 huge_size = 2 * 1024 * 1024;
+#ifdef __linux__
+        FILE* fp = fopen("/proc/meminfo", "r");
+        if (fp == nullptr)
+        {
+            return huge_size;
+        }
+        char line[256];
+        while (fgets(line, sizeof(line), fp) != nullptr)
+        {
+            long long kb = 0;
+            if (sscanf(line, "Hugepagesize: %lld kB", &kb) == 1 && kb > 0)
+            {
+                huge_size = kb * 1024;
+                break;
+            }
+        }
+        fclose(fp);
+#endif
+        return huge_size;
+    }
+
+    //the real page size of the mapping which contain addr. (KernelPageSize in /proc/self/smaps)
+    //return normal page size when not support query.
+    static inline s64 query_page_size(const void* addr)
+    {
+        s64 page_size = normal_page_size();
+#ifdef __linux__
+        FILE* fp = fopen("/proc/self/smaps", "r");
+        if (fp == nullptr)
+        {
+            return page_size;
+        }
+        char line[512];
+        bool in_range = false;
+        while (fgets(line, sizeof(line), fp) != nullptr)
+        {
+            unsigned long long begin = 0;
+            unsigned long long end = 0;
+            char perms[8] = { 0 };
+            if (sscanf(line, "%llx-%llx %7s", &begin, &end, perms) == 3)
+            {
+                in_range = (u64)addr >= begin && (u64)addr < end;
+                continue;
+            }
+            long long kb = 0;
+            if (in_range && sscanf(line, "KernelPageSize: %lld kB", &kb) == 1)
+            {
+                page_size = kb * 1024;
+                break;
+            }
+        }
+        fclose(fp);
+#endif
+        return page_size;
+    }
 
     class zshm_loader_win32
     {
@@ -165,15 +243,18 @@ namespace zshm_loader_impl
         {
             init(0, 0);
         }
-        void init(u64 shm_key, s64 mem_size)
+        //huge_page: file mapping not support large page (need SeLockMemoryPrivilege and pagefile backed). always normal page.
+        void init(u64 shm_key, s64 mem_size, bool huge_page = false)
         {
             shm_key_ = shm_key;
             shm_mem_size_ = mem_size;
             shm_mnt_addr_ = nullptr;
+            (void)huge_page;
         }
 
         s64 shm_mem_size() { return shm_mem_size_; }
         void* shm_mnt_addr() { return shm_mnt_addr_; }
+        s64 shm_page_size() { return normal_page_size(); }
     private:
         u64 shm_key_;
         s64 shm_mem_size_;
@@ -217,7 +298,7 @@ namespace zshm_loader_impl
 
 
 
-        s32 attach(u64 expect_addr = 0)
+        s32 attach(u64 expect_addr = 0, bool readonly = false)
         {
             if (shm_key_ == 0)
             {
@@ -255,7 +336,7 @@ namespace zshm_loader_impl
 
             ::CloseHandle(handle);
 
-            LPVOID addr = MapViewOfFileEx(mapping_handle, FILE_MAP_ALL_ACCESS, 0, 0, shm_mem_size_, (void*)expect_addr);
+            LPVOID addr = MapViewOfFileEx(mapping_handle, readonly ? FILE_MAP_READ : FILE_MAP_ALL_ACCESS, 0, 0, shm_mem_size_, (void*)expect_addr);
             if (addr == nullptr)
             {
                 volatile DWORD dw = GetLastError();
@@ -353,6 +434,17 @@ namespace zshm_loader_impl
             ::remove(str_key.c_str());
             return 0;
         }
+
+        static s32 external_detach(void* real_addr, s64 mem_size)
+        {
+#ifdef WIN32
+            if (real_addr != nullptr)
+            {
+                UnmapViewOfFile(real_addr);
+            }
+#endif
+            return 0;
+        }
     };
 
 
@@ -364,20 +456,25 @@ namespace zshm_loader_impl
         {
             init(0, 0);
         }
-        void init(u64 shm_key, s64 mem_size)
+        void init(u64 shm_key, s64 mem_size, bool huge_page = false)
         {
             shm_key_ = shm_key;
             shm_index_ = -1;
             shm_mem_size_ = mem_size;
             shm_mnt_addr_ = nullptr;
+            huge_page_ = huge_page;
+            shm_page_size_ = 0;
         }
         s64 shm_mem_size() { return shm_mem_size_; }
         void* shm_mnt_addr() { return shm_mnt_addr_; }
+        s64 shm_page_size() { return shm_page_size_; }
     private:
         u64 shm_key_;
         s32 shm_index_;
         s64 shm_mem_size_;
         void* shm_mnt_addr_;
+        bool huge_page_;
+        s64 shm_page_size_;
     public:
         s32 check()
         {
@@ -400,7 +497,7 @@ namespace zshm_loader_impl
         }
 
 
-        s32 attach(u64 expect_addr = 0)
+        s32 attach(u64 expect_addr = 0, bool readonly = false)
         {
             if (shm_key_ == 0)
             {
@@ -417,13 +514,14 @@ namespace zshm_loader_impl
                 return zshm_errno::E_INVALID_SHM_MAPPING;
             }
 
-            void* addr = shmat(idx, (void*)expect_addr, 0);
+            void* addr = shmat(idx, (void*)expect_addr, readonly ? SHM_RDONLY : 0);
             if (addr == nullptr || addr == (void*)-1)
             {
                 return zshm_errno::E_ATTACH_SHM_MAPPING_FAILED;
             }
             shm_index_ = idx;
             shm_mnt_addr_ = addr;
+            shm_page_size_ = query_page_size(addr);
 #endif
             return 0;
         }
@@ -437,7 +535,25 @@ namespace zshm_loader_impl
 #ifndef WIN32
             //可读写共享  
             //创建且不允许已经存在  
-            s32 idx = shmget(shm_key_, shm_mem_size_, IPC_CREAT | IPC_EXCL | 0600);
+            s32 idx = -1;
+            shm_page_size_ = normal_page_size();
+#ifdef SHM_HUGETLB
+            if (huge_page_)
+            {
+                //size must align huge page.  fail when vm.nr_hugepages not enough, then fallback to normal page.  
+                s64 huge_size = huge_page_size();
+                s64 huge_mem_size = (shm_mem_size_ + huge_size - 1) / huge_size * huge_size;
+                idx = shmget(shm_key_, huge_mem_size, IPC_CREAT | IPC_EXCL | SHM_HUGETLB | 0600);
+                if (idx >= 0)
+                {
+                    shm_page_size_ = huge_size;
+                }
+            }
+#endif
+            if (idx < 0)
+            {
+                idx = shmget(shm_key_, shm_mem_size_, IPC_CREAT | IPC_EXCL | 0600);
+            }
             if (idx < 0)
             {
                 return zshm_errno::E_CREATE_SHM_MAPPING_FAILED;
@@ -503,6 +619,17 @@ namespace zshm_loader_impl
                 return zshm_errno::E_INVALID_SHM_MAPPING;
             }
             shmctl(idx, IPC_RMID, nullptr);
+#endif
+            return 0;
+        }
+
+        static s32 external_detach(void* real_addr, s64 mem_size)
+        {
+#ifndef WIN32
+            if (real_addr != nullptr)
+            {
+                shmdt(real_addr);
+            }
 #endif
             return 0;
         }
@@ -518,36 +645,77 @@ namespace zshm_loader_impl
         {
             init(0, 0);
         }
-        void init(u64 shm_key, s64 mem_size)
+        void init(u64 shm_key, s64 mem_size, bool huge_page = false)
         {
             shm_key_ = shm_key;
             shm_mnt_addr_ = nullptr;
             shm_mem_size_ = mem_size;
+            shm_map_size_ = mem_size;
+            huge_page_ = huge_page;
+            shm_page_size_ = 0;
         }
         s64 shm_mem_size() { return shm_mem_size_; }
         void* shm_mnt_addr() { return shm_mnt_addr_; }
+        s64 shm_page_size() { return shm_page_size_; }
     private:
         u64 shm_key_;
         void* shm_mnt_addr_;
         s64 shm_mem_size_;
+        s64 shm_map_size_;
+        bool huge_page_;
+        s64 shm_page_size_;
     public:
         s32 check()
         {
             return zshm_errno::E_NO_SHM_MAPPING;
         }
 
-        s32 attach(u64 expect_addr = 0)
+        s32 attach(u64 expect_addr = 0, bool readonly = false)
         {
             return zshm_errno::E_NO_SHM_MAPPING;
         }
 
         s32 create(u64 expect_addr = 0)
         {
+            shm_map_size_ = shm_mem_size_;
+            shm_page_size_ = normal_page_size();
     #ifdef WIN32
             //提交内存不代表实际使用 但windows下系统提交内存总大小不能超过物理内存+交换文件 否则会内存不足.  
             char* addr = (char*)VirtualAlloc((LPVOID)expect_addr, shm_mem_size_, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE);
     #else
-            char* addr = (char*)mmap(NULL, shm_mem_size_, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+            char* addr = nullptr;
+    #ifdef MAP_HUGETLB
+            if (huge_page_)
+            {
+                s64 huge_size = huge_page_size();
+                s64 huge_map_size = (shm_mem_size_ + huge_size - 1) / huge_size * huge_size;
+                addr = (char*)mmap(NULL, huge_map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (addr == MAP_FAILED)
+                {
+                    addr = nullptr;
+                }
+                else
+                {
+                    shm_map_size_ = huge_map_size;
+                    shm_page_size_ = huge_size;
+                }
+            }
+    #endif
+            if (addr == nullptr)
+            {
+                addr = (char*)mmap(NULL, shm_mem_size_, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+                if (addr == MAP_FAILED)
+                {
+                    addr = nullptr;
+                }
+    #ifdef MADV_HUGEPAGE
+                if (addr != nullptr && huge_page_)
+                {
+                    //no reserved huge page: let THP try to merge it.  
+                    madvise(addr, shm_mem_size_, MADV_HUGEPAGE);
+                }
+    #endif
+            }
     #endif // WIN32
             if (addr == nullptr)
             {
@@ -570,7 +738,7 @@ namespace zshm_loader_impl
     #ifdef WIN32
                 VirtualFree(shm_mnt_addr_, 0, MEM_RELEASE);
     #else
-                munmap(shm_mnt_addr_, shm_mem_size_);
+                munmap(shm_mnt_addr_, shm_map_size_);
     #endif // WIN32
                 shm_mnt_addr_ = nullptr;
             }
@@ -598,6 +766,11 @@ namespace zshm_loader_impl
     #endif // WIN32
             return 0;
         }
+
+        static s32 external_detach(void* real_addr, s64 mem_size)
+        {
+            return external_destroy(0, real_addr, mem_size);
+        }
     };
 
 }
@@ -615,16 +788,16 @@ class zshm_loader
     heap_loader heap_loader_;
     bool used_heap_;
 public:
-    zshm_loader(bool used_heap = false, u64 shm_key = 0, s64 mem_size = 0)
+    zshm_loader(bool used_heap = false, u64 shm_key = 0, s64 mem_size = 0, bool huge_page = false)
     {
-        init(used_heap, shm_key, mem_size);
+        init(used_heap, shm_key, mem_size, huge_page);
     }
 
-    void init(bool used_heap, u64 shm_key, s64 mem_size)
+    void init(bool used_heap, u64 shm_key, s64 mem_size, bool huge_page = false)
     {
         used_heap_ = used_heap;
-        loader_.init(shm_key, mem_size);
-        heap_loader_.init(shm_key, mem_size);
+        loader_.init(shm_key, mem_size, huge_page);
+        heap_loader_.init(shm_key, mem_size, huge_page);
     }
 
     ~zshm_loader()
@@ -633,10 +806,13 @@ public:
 
     s64 shm_mem_size() { return used_heap_ ? heap_loader_.shm_mem_size() : loader_.shm_mem_size(); }
     void* shm_mnt_addr() { return used_heap_ ? heap_loader_.shm_mnt_addr() : loader_.shm_mnt_addr(); }
+    s64 shm_page_size() { return used_heap_ ? heap_loader_.shm_page_size() : loader_.shm_page_size(); }
+    static s64 query_page_size(const void* addr) { return zshm_loader_impl::query_page_size(addr); }
 
     s32 check(){return used_heap_ ? heap_loader_.check(): loader_.check();}
 
-    s32 attach(u64 expect_addr = 0){return used_heap_ ? heap_loader_.attach(expect_addr): loader_.attach(expect_addr);}
+    //readonly: SHM_RDONLY / FILE_MAP_READ, any write to the mapping faults.  
+    s32 attach(u64 expect_addr = 0, bool readonly = false){return used_heap_ ? heap_loader_.attach(expect_addr, readonly): loader_.attach(expect_addr, readonly);}
     s32 create(u64 expect_addr = 0){return used_heap_ ? heap_loader_.create(expect_addr): loader_.create(expect_addr);}
 
     bool is_attach(){return used_heap_ ? heap_loader_.is_attach(): loader_.is_attach();}
@@ -653,6 +829,15 @@ public:
         }
         return impl_loader::external_destroy(shm_key, real_addr, mem_size);
     }
+
+    static s32 external_detach(s32 use_heap, void* real_addr, s64 mem_size)
+    {
+        if (use_heap)
+        {
+            return heap_loader::external_detach(real_addr, mem_size);
+        }
+        return impl_loader::external_detach(real_addr, mem_size);
+    }
 };
 
 
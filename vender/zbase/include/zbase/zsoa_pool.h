@@ -0,0 +1,170 @@
+/*
+* Copyright (C) 2019 YaweiZhang <yawei.zhang@foxmail.com>.
+* All rights reserved
+* This file is part of the zbase, used MIT License.
+*/
+
+
+#pragma once
+#ifndef ZSOA_POOL_H
+#define ZSOA_POOL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include <cstddef>
+
+#ifndef ZBASE_SHORT_TYPE
+#define ZBASE_SHORT_TYPE
+using s8 =  int8_t;
+using u8 =  uint8_t;
+using s16 = int16_t;
+using u16 = uint16_t;
+using s32 = int32_t;
+using u32 = uint32_t;
+using s64 = int64_t;
+using u64 = uint64_t;
+using f32 = float;
+using f64 = double;
+#endif
+
+
+/* type_traits:
+*
+* is_trivially_copyable: yes
+    * memset: yes
+    * memcpy: yes
+* shm resume : safely, require space address fixed
+    * has vptr:     no
+    * static var:   no
+    * has heap ptr: yes (space)
+    * has code ptr: no
+* thread safe: read safe
+*
+*/
+
+
+/*
+* structure-of-arrays columns for the hot members of pool objects.
+* column element is addressed by the chunk id of the object in its zmem_pool,
+* every column is a contiguous array of total_count elements and aligned to cache line.
+* element only store trivial value (no vptr), so nothing to fix when resume.
+*/
+class zsoa_pool
+{
+public:
+    static constexpr s32 MAX_COLUMNS = 8;
+    static constexpr s32 COLUMN_ALIGN = 64;
+
+    s32 obj_count_;
+    s32 column_count_;
+    s32 column_size_[MAX_COLUMNS];
+    s64 column_offset_[MAX_COLUMNS];
+    char* space_;
+    s64  space_size_;
+
+    static constexpr s64 align_column(s64 input_size) { return (input_size + COLUMN_ALIGN - 1) / COLUMN_ALIGN * COLUMN_ALIGN; }
+
+    //space from pool is 8 bytes aligned, reserve one cache line to align the first column.
+    static inline s64 calculate_space_size(s32 total_count, const s32* column_size, s32 column_count)
+    {
+        if (column_count <= 0)
+        {
+            return 0;
+        }
+        s64 space_size = COLUMN_ALIGN;
+        for (s32 i = 0; i < column_count; i++)
+        {
+            space_size += align_column((s64)column_size[i] * total_count);
+        }
+        return space_size;
+    }
+
+    inline s32 init(s32 total_count, const s32* column_size, s32 column_count, void* space, s64 space_size)
+    {
+        static_assert(std::is_trivially_copyable<zsoa_pool>::value, "");
+        memset(this, 0, sizeof(zsoa_pool));
+        if (column_count == 0)
+        {
+            return 0;
+        }
+        if (column_count < 0 || column_count > MAX_COLUMNS || column_size == nullptr)
+        {
+            return -1;
+        }
+        if (space == nullptr)
+        {
+            return -2;
+        }
+        if (total_count <= 0)
+        {
+            return -3;
+        }
+        if (space_size < calculate_space_size(total_count, column_size, column_count))
+        {
+            return -4;
+        }
+        obj_count_ = total_count;
+        column_count_ = column_count;
+        space_ = (char*)space;
+        space_size_ = space_size;
+        s64 offset = align_column((u64)space_) - (u64)space_;
+        for (s32 i = 0; i < column_count; i++)
+        {
+            if (column_size[i] <= 0)
+            {
+                return -5;
+            }
+            column_size_[i] = column_size[i];
+            column_offset_[i] = offset;
+            offset += align_column((s64)column_size[i] * total_count);
+        }
+        return 0;
+    }
+
+    inline bool has_columns() const { return column_count_ > 0; }
+    inline s32 column_count() const { return column_count_; }
+    inline s32 max_size() const { return obj_count_; }
+
+    inline char* column(s32 column_id) { return space_ + column_offset_[column_id]; }
+    inline const char* column(s32 column_id) const { return space_ + column_offset_[column_id]; }
+    inline char* at(s32 column_id, s32 chunk_id) { return column(column_id) + (s64)column_size_[column_id] * chunk_id; }
+
+    template<class _Ty>
+    inline _Ty* column(s32 column_id) { return reinterpret_cast<_Ty*>(column(column_id)); }
+    template<class _Ty>
+    inline _Ty& at(s32 column_id, s32 chunk_id) { return column<_Ty>(column_id)[chunk_id]; }
+
+    /*
+    * relocate all columns from an old soa which has same column sizes and less or equal obj count.
+    * chunk id is kept, src_space is the current address of src's space (src.space_ maybe invalid).
+    */
+    s32 relocate(const zsoa_pool& src, const char* src_space)
+    {
+        if (src.column_count_ == 0)
+        {
+            return 0;
+        }
+        if (src_space == nullptr)
+        {
+            return -1;
+        }
+        if (src.column_count_ != column_count_ || src.obj_count_ > obj_count_)
+        {
+            return -2;
+        }
+        for (s32 i = 0; i < column_count_; i++)
+        {
+            if (src.column_size_[i] != column_size_[i])
+            {
+                return -3;
+            }
+            memcpy(column(i), src_space + src.column_offset_[i], (s64)column_size_[i] * src.obj_count_);
+        }
+        return 0;
+    }
+};
+
+
+
+#endif
@@ -0,0 +1,476 @@
+/*
+* Copyright (C) 2019 YaweiZhang <yawei.zhang@foxmail.com>.
+* All rights reserved
+* This file is part of the zbase, used MIT License.
+*/
+
+
+#pragma once
+#ifndef ZTCACHE_H
+#define ZTCACHE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "zmalloc.h"
+#include "zmalloc_arenas.h"
+
+#ifndef ZBASE_SHORT_TYPE
+#define ZBASE_SHORT_TYPE
+using s8 =  int8_t;
+using u8 =  uint8_t;
+using s16 = int16_t;
+using u16 = uint16_t;
+using s32 = int32_t;
+using u32 = uint32_t;
+using s64 = int64_t;
+using u64 = uint64_t;
+using f32 = float;
+using f64 = double;
+#endif
+
+
+/* type_traits:
+*
+* is_trivially_copyable: no (atomic lock and owners)
+    * memset: yes (only in init)
+    * memcpy: no
+* shm resume : safely, require arenas address fixed. call recover() before any thread allocs.
+    * has vptr:     no
+    * static var:   yes (global instance ptr, thread slot of every thread. both are rebuilt)
+    * has heap ptr: yes (cached chunks in zmalloc heap)
+    * has code ptr: no
+* thread safe: yes (every thread has its own slot, arenas are only touched under the lock)
+*
+*/
+
+
+/*
+* per-thread small chunk caches in front of zmalloc_arenas.
+* every thread claims a slot of the table on its first alloc/free. small chunks (< zmalloc::SMALL_MAX_REQUEST) are
+* (slab slots or chunks) popped from and pushed to the bins of the slot without any lock; an empty bin is refilled by BATCH_COUNT chunks and
+* a full bin flushes BATCH_COUNT chunks, both in one hold of the spin lock. big chunks go to zmalloc under the lock.
+* only colors of the default arena (0) are cached, colors bound to other arenas always go to their arena under the lock.
+* cached chunks are in-used chunks of zmalloc linked by their payload, so the table and the chunks are all in shm,
+* the resumed process gives every cached chunk back by recover().
+* a cached chunk keeps the color of the refill, the color counters of zmalloc are by bins, not by callers.
+*/
+class ztcache
+{
+public:
+    static constexpr u32 MAX_THREADS = 64;
+    static constexpr u32 BIN_COUNT = zmalloc::BINMAP_SIZE; //chunk bin_id of small chunks
+    static constexpr u32 BATCH_COUNT = 32;
+    static constexpr u32 MAX_BIN_COUNT = BATCH_COUNT * 2;
+    static constexpr u32 SPIN_COUNT = 64;
+
+    //sizes are kept in cache lines by hand: the table is placed in shm at a 16 bytes aligned offset.
+    struct thread_cache
+    {
+        std::atomic<u32> owner_; //0 is free
+        u32 reserve_;
+        u64 alloc_count_;
+        u64 free_count_;
+        u64 refill_count_;
+        u64 flush_count_;
+        u32 bin_count_[BIN_COUNT];
+        void* bin_[BIN_COUNT];
+        u64 padding_[3];
+    };
+    static_assert(sizeof(thread_cache) % 64 == 0, "");
+
+public:
+    inline static ztcache& instance() { return *instance_ptr(); }
+    inline static ztcache*& instance_ptr() { static ztcache* g_ztcache_state = NULL; return g_ztcache_state; }
+    inline static void set_global(ztcache* state) { instance_ptr() = state; }
+
+    //zallocator entry: the global cache when it's set, else the global zmalloc (single thread).
+    template<u16 COLOR = 0>
+    inline static void* alloc_global(u64 bytes)
+    {
+        ztcache* cache = instance_ptr();
+        return cache != NULL ? cache->alloc_memory<COLOR>(bytes) : zmalloc::instance().alloc_memory<COLOR>(bytes);
+    }
+    inline static u64 free_global(void* addr)
+    {
+        ztcache* cache = instance_ptr();
+        return cache != NULL ? cache->free_memory(addr) : zmalloc::instance().free_memory(addr);
+    }
+
+    inline static u64 usable_size_global(void* addr)
+    {
+        ztcache* cache = instance_ptr();
+        return cache != NULL ? cache->usable_size(addr) : zmalloc::instance().usable_size(addr);
+    }
+    inline static bool try_expand_global(void* addr, u64 bytes)
+    {
+        ztcache* cache = instance_ptr();
+        return cache != NULL ? cache->try_expand(addr, bytes) : zmalloc::instance().try_expand(addr, bytes);
+    }
+    template<u16 COLOR = 0>
+    inline static void* realloc_global(void* addr, u64 bytes)
+    {
+        ztcache* cache = instance_ptr();
+        return cache != NULL ? cache->realloc_memory<COLOR>(addr, bytes) : zmalloc::instance().realloc_memory<COLOR>(addr, bytes);
+    }
+
+    inline void init(zmalloc_arenas* arenas)
+    {
+        memset((void*)this, 0, sizeof(ztcache));
+        arenas_ = arenas;
+        epoch_ = 1;
+    }
+
+    /*
+    * after resume, before any thread allocs: threads of the old process are gone,
+    * give all cached chunks back to zmalloc and free all slots. return chunks given back.
+    */
+    inline u64 recover(zmalloc_arenas* arenas)
+    {
+        arenas_ = arenas;
+        lock_.store(0, std::memory_order_relaxed);
+        epoch_++;
+        u64 count = 0;
+        for (u32 i = 0; i < MAX_THREADS; i++)
+        {
+            count += flush_all(caches_[i]);
+            caches_[i].owner_.store(0, std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        return count;
+    }
+
+    template<u16 COLOR = 0>
+    inline void* alloc_memory(u64 bytes)
+    {
+        if (bytes < zmalloc::SMALL_MAX_REQUEST - zmalloc::FINE_GRAINED_SIZE && arenas_->arena_of(COLOR) == 0)
+        {
+            thread_cache* tc = local();
+            if (tc != NULL)
+            {
+                u32 small_id = bytes < zmalloc::FINE_GRAINED_SIZE ? 1 : (u32)(bytes + zmalloc::FINE_GRAINED_MASK) >> zmalloc::FINE_GRAINED_SHIFT;
+                if (tc->bin_count_[small_id] == 0 && refill<COLOR>(*tc, small_id) == 0)
+                {
+                    return NULL;
+                }
+                void* addr = tc->bin_[small_id];
+                tc->bin_[small_id] = *(void**)addr;
+                tc->bin_count_[small_id]--;
+                tc->alloc_count_++;
+                return addr;
+            }
+        }
+        lock();
+        void* addr = arenas_->alloc_memory<COLOR>(bytes);
+        unlock();
+        return addr;
+    }
+
+    inline u64 free_memory(void* addr)
+    {
+        if (addr == NULL)
+        {
+            return 0;
+        }
+        u32 bin_id = BIN_COUNT;
+        u32 color = 0;
+        u64 bytes = 0;
+        zmalloc::slab_page* page = arenas_->find_slab(addr); //lock free, see zmalloc::find_slab
+        if (page != NULL)
+        {
+            bin_id = page->class_size >> zmalloc::FINE_GRAINED_SHIFT;
+            color = page->color;
+            bytes = page->class_size;
+        }
+        else
+        {
+            zmalloc::chunk_type* chunk = zmalloc_chunk_cast(zmalloc_u64_cast(addr) - zmalloc::CHUNK_PADDING_SIZE);
+            if ((chunk->flags & (zmalloc::CHUNK_IS_IN_USED | zmalloc::CHUNK_IS_DIRECT | zmalloc::CHUNK_LEVEL_MASK)) == zmalloc::CHUNK_IS_IN_USED)
+            {
+                bin_id = chunk->bin_id;
+                color = (chunk->flags & zmalloc::CHUNK_COLOR_MASK) >> 1;
+                bytes = chunk->this_size - zmalloc::CHUNK_PADDING_SIZE;
+            }
+        }
+        if (bin_id < BIN_COUNT && arenas_->arena_of(color) == 0)
+        {
+            thread_cache* tc = local();
+            if (tc != NULL)
+            {
+                *(void**)addr = tc->bin_[bin_id];
+                tc->bin_[bin_id] = addr;
+                tc->free_count_++;
+                if (++tc->bin_count_[bin_id] > MAX_BIN_COUNT)
+                {
+                    flush(*tc, bin_id, BATCH_COUNT);
+                }
+                return bytes;
+            }
+        }
+        lock();
+        bytes = arenas_->free_memory(addr);
+        unlock();
+        return bytes;
+    }
+
+    inline u64 usable_size(void* addr)
+    {
+        lock();
+        u64 bytes = arenas_->usable_size(addr);
+        unlock();
+        return bytes;
+    }
+
+    //in place by the arena of addr, the chunk is owned by the caller so it's never in a thread cache.
+    inline bool try_expand(void* addr, u64 bytes)
+    {
+        lock();
+        bool ret = arenas_->try_expand(addr, bytes);
+        unlock();
+        return ret;
+    }
+
+    template<u16 COLOR = 0>
+    inline void* realloc_memory(void* addr, u64 bytes)
+    {
+        if (addr == NULL)
+        {
+            return alloc_memory<COLOR>(bytes);
+        }
+        if (bytes == 0)
+        {
+            free_memory(addr);
+            return NULL;
+        }
+        if (try_expand(addr, bytes))
+        {
+            return addr;
+        }
+        void* new_addr = alloc_memory<COLOR>(bytes);
+        if (new_addr == NULL)
+        {
+            return NULL;
+        }
+        u64 old_bytes = usable_size(addr);
+        memcpy(new_addr, addr, old_bytes < bytes ? old_bytes : bytes);
+        free_memory(addr);
+        return new_addr;
+    }
+
+    //aligned and batch requests skip the thread cache, a batch holds the lock once.  
+    template<u16 COLOR = 0>
+    inline void* alloc_aligned(u64 bytes, u64 align)
+    {
+        lock();
+        void* addr = arenas_->alloc_aligned<COLOR>(bytes, align);
+        unlock();
+        return addr;
+    }
+
+    template<u16 COLOR = 0>
+    inline u32 alloc_batch(u64 bytes, u32 count, void** out)
+    {
+        lock();
+        u32 done = arenas_->alloc_batch<COLOR>(bytes, count, out);
+        unlock();
+        return done;
+    }
+
+    inline u64 free_batch(void** addrs, u32 count)
+    {
+        lock();
+        u64 bytes = arenas_->free_batch(addrs, count);
+        unlock();
+        return bytes;
+    }
+
+    //give the chunks cached by this thread back and free its slot. call before a thread exits when the table is kept.
+    inline void release_thread()
+    {
+        local_slot& slot = local_ref();
+        if (slot.cache_ == this && slot.epoch_ == epoch_ && slot.tc_ != NULL)
+        {
+            flush_all(*slot.tc_);
+            slot.tc_->owner_.store(0, std::memory_order_release);
+        }
+        slot.cache_ = NULL;
+        slot.tc_ = NULL;
+    }
+
+    /*
+    * bind a color to an arena under the lock, the chunks cached by this thread are given back first.
+    * cached chunks keep their color and are freed by it, so chunks of the color cached by other threads
+    * still count as live (-2) until those threads give them back (release_thread).
+    */
+    inline s32 bind_color(u32 color, u32 arena_id)
+    {
+        local_slot& slot = local_ref();
+        if (slot.cache_ == this && slot.epoch_ == epoch_ && slot.tc_ != NULL)
+        {
+            flush_all(*slot.tc_);
+        }
+        lock();
+        s32 ret = arenas_->bind_color(color, arena_id);
+        unlock();
+        return ret;
+    }
+
+    //arenas used directly by other code (bind/release/check/debug log) must hold the lock when other threads are running.
+    inline void lock()
+    {
+        if (!lock_.exchange(1, std::memory_order_acquire))
+        {
+            return;
+        }
+        u32 spin = 0;
+        do
+        {
+            while (lock_.load(std::memory_order_relaxed))
+            {
+                if (++spin > SPIN_COUNT)
+                {
+                    std::this_thread::yield();
+                }
+            }
+        } while (lock_.exchange(1, std::memory_order_acquire));
+        contended_count_++;
+    }
+    inline void unlock() { lock_.store(0, std::memory_order_release); }
+
+    inline u32 used_threads() const
+    {
+        u32 count = 0;
+        for (u32 i = 0; i < MAX_THREADS; i++)
+        {
+            count += caches_[i].owner_.load(std::memory_order_relaxed) != 0 ? 1 : 0;
+        }
+        return count;
+    }
+
+    template<class StreamLog>
+    inline void debug_state_log(StreamLog logwrap)
+    {
+        u64 alloc_count = 0;
+        u64 free_count = 0;
+        u64 refill_count = 0;
+        u64 flush_count = 0;
+        u64 cached_count = 0;
+        for (u32 i = 0; i < MAX_THREADS; i++)
+        {
+            const thread_cache& tc = caches_[i];
+            alloc_count += tc.alloc_count_;
+            free_count += tc.free_count_;
+            refill_count += tc.refill_count_;
+            flush_count += tc.flush_count_;
+            for (u32 bin_id = 0; bin_id < BIN_COUNT; bin_id++)
+            {
+                cached_count += tc.bin_count_[bin_id];
+            }
+        }
+        logwrap() << "* [tcache]: used_threads:" << used_threads() << ", cached chunks:" << cached_count << ", alloc_count:" << alloc_count << ", free_count:" << free_count
+            << ", refill_count:" << refill_count << ", flush_count:" << flush_count << ", contended_count_:" << contended_count_;
+    }
+
+private:
+    struct local_slot
+    {
+        ztcache* cache_;
+        thread_cache* tc_;
+        u32 epoch_;
+        ~local_slot()
+        {
+            //the table maybe unmapped already (frame exited), only release it when it's still the global one.
+            if (cache_ != NULL && cache_ == instance_ptr())
+            {
+                cache_->release_thread();
+            }
+        }
+    };
+    inline static local_slot& local_ref() { static thread_local local_slot slot = { NULL, NULL, 0 }; return slot; }
+
+    //slot of this thread, NULL when all slots are used.
+    inline thread_cache* local()
+    {
+        local_slot& slot = local_ref();
+        if (slot.cache_ == this && slot.epoch_ == epoch_)
+        {
+            return slot.tc_;
+        }
+        slot.cache_ = this;
+        slot.epoch_ = epoch_;
+        slot.tc_ = NULL;
+        for (u32 i = 0; i < MAX_THREADS; i++)
+        {
+            u32 expect = 0;
+            if (caches_[i].owner_.compare_exchange_strong(expect, 1, std::memory_order_acquire))
+            {
+                slot.tc_ = &caches_[i];
+                break;
+            }
+        }
+        return slot.tc_;
+    }
+
+    template<u16 COLOR>
+    inline u32 refill(thread_cache& tc, u32 small_id)
+    {
+        u32 count = 0;
+        lock();
+        for (; count < BATCH_COUNT; count++)
+        {
+            void* addr = arenas_->alloc_memory<COLOR>((u64)small_id << zmalloc::FINE_GRAINED_SHIFT);
+            if (addr == NULL)
+            {
+                break;
+            }
+            *(void**)addr = tc.bin_[small_id];
+            tc.bin_[small_id] = addr;
+        }
+        unlock();
+        tc.bin_count_[small_id] += count;
+        tc.refill_count_++;
+        return count;
+    }
+
+    inline u32 flush(thread_cache& tc, u32 bin_id, u32 count)
+    {
+        u32 flushed = 0;
+        lock();
+        for (; flushed < count && tc.bin_[bin_id] != NULL; flushed++)
+        {
+            void* addr = tc.bin_[bin_id];
+            tc.bin_[bin_id] = *(void**)addr;
+            arenas_->free_memory(addr);
+        }
+        unlock();
+        tc.bin_count_[bin_id] -= flushed;
+        tc.flush_count_++;
+        return flushed;
+    }
+
+    inline u64 flush_all(thread_cache& tc)
+    {
+        u64 count = 0;
+        for (u32 bin_id = 0; bin_id < BIN_COUNT; bin_id++)
+        {
+            if (tc.bin_count_[bin_id] > 0)
+            {
+                count += flush(tc, bin_id, tc.bin_count_[bin_id]);
+            }
+        }
+        return count;
+    }
+
+private:
+    std::atomic<u32> lock_;
+    u32 epoch_;
+    zmalloc_arenas* arenas_;
+    u64 contended_count_;
+    u64 padding_[5];
+    thread_cache caches_[MAX_THREADS];
+};
+static_assert(sizeof(ztcache) % 64 == 0, "");
+
+
+#endif
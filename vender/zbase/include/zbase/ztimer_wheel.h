@@ -0,0 +1,251 @@
+/*
+* Copyright (C) 2019 YaweiZhang <yawei.zhang@foxmail.com>.
+* All rights reserved
+* This file is part of the zbase, used MIT License.
+*/
+
+
+#pragma once
+#ifndef ZTIMER_WHEEL_H
+#define ZTIMER_WHEEL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <cstddef>
+#include "zmem_pool.h"
+
+
+/* type_traits:
+*
+* is_trivially_copyable: in part
+    * memset: no
+    * memcpy: no (nodes space)
+* shm resume : safely, require nodes space address fixed
+    * has vptr:     no
+    * static var:   no
+    * has heap ptr: yes (nodes space)
+    * has code ptr: no (callback is id)
+* thread safe: no
+*
+*/
+
+
+/*
+* hierarchical timing wheel in ms.
+* near wheel 256 slots, 4 levels of 64 slots, max delay 2^32 ms (longer is clamped).
+* nodes are chunks of a zmem_pool, slots are double linked lists of chunk id.
+* add/cancel O(1), expire walks ms by ms and cascades one level slot every 256ms.
+* timer id: high 32 bits is the seq of node, low 32 bits is the chunk id. 0 is invalid.
+*/
+class ztimer_wheel
+{
+public:
+    static constexpr u32 NEAR_BITS = 8;
+    static constexpr u32 NEAR_SLOTS = 1 << NEAR_BITS;
+    static constexpr u32 LEVEL_BITS = 6;
+    static constexpr u32 LEVEL_SLOTS = 1 << LEVEL_BITS;
+    static constexpr u32 LEVELS = 4;
+    static constexpr u32 SLOTS = NEAR_SLOTS + LEVEL_SLOTS * LEVELS;
+    static constexpr u64 MAX_DELAY = (1ULL << (NEAR_BITS + LEVEL_BITS * LEVELS)) - 1;
+    static constexpr u32 INVALID_ID = 0xffffffff;
+
+    struct node
+    {
+        s64 expire_ms_;
+        u64 userdata_;
+        u32 prev_;
+        u32 next_;
+        u32 slot_;
+        u32 seq_;
+        u32 callback_id_;
+        u32 reserve_;
+    };
+
+    static constexpr s64 calculate_space_size(s32 total_count) { return zmem_pool::calculate_space_size(sizeof(node), total_count); }
+
+    inline s32 init(s32 total_count, void* space, s64 space_size, s64 now_ms)
+    {
+        s32 ret = nodes_.init(sizeof(node), 0, 0, total_count, space, space_size);
+        if (ret != 0)
+        {
+            return ret;
+        }
+        cur_ms_ = now_ms;
+        seq_ = 0;
+        for (u32 i = 0; i < SLOTS; i++)
+        {
+            slots_[i] = INVALID_ID;
+        }
+        return 0;
+    }
+
+    inline s32 size() const { return nodes_.size(); }
+    inline s32 max_size() const { return nodes_.max_size(); }
+    inline s64 cur_ms() const { return cur_ms_; }
+
+    //return timer id, 0 is full.
+    inline u64 add(s64 expire_ms, u32 callback_id, u64 userdata)
+    {
+        node* n = (node*)nodes_.exploit();
+        if (n == nullptr)
+        {
+            return 0;
+        }
+        u32 id = (u32)nodes_.chunk_id(n);
+        n->expire_ms_ = expire_ms;
+        n->userdata_ = userdata;
+        n->callback_id_ = callback_id;
+        n->seq_ = ++seq_ == 0 ? ++seq_ : seq_;
+        link(id, n);
+        return ((u64)n->seq_ << 32) | id;
+    }
+
+    inline s32 cancel(u64 timer_id)
+    {
+        node* n = find(timer_id);
+        if (n == nullptr)
+        {
+            return -1;
+        }
+        unlink((u32)timer_id, n);
+        nodes_.back(n);
+        return 0;
+    }
+
+    inline node* find(u64 timer_id)
+    {
+        u32 id = (u32)timer_id;
+        if (timer_id == 0 || id >= (u32)nodes_.window_size() || !nodes_.ref(id)->used_)
+        {
+            return nullptr;
+        }
+        node* n = (node*)nodes_.at(id);
+        if (n->seq_ != (u32)(timer_id >> 32))
+        {
+            return nullptr;
+        }
+        return n;
+    }
+
+    /*
+    * fire all timers expired at or before now_ms, fn(timer_id, callback_id, userdata, expire_ms).
+    * the node is released before fn, so fn can add new timers (include itself again).
+    * return the fired count.
+    */
+    template<class Fn>
+    inline u32 expire(s64 now_ms, Fn&& fn)
+    {
+        u32 fired = 0;
+        while (cur_ms_ <= now_ms)
+        {
+            u64 tick = (u64)cur_ms_;
+            if ((tick & (NEAR_SLOTS - 1)) == 0)
+            {
+                for (u32 level = 0; level < LEVELS; level++)
+                {
+                    u32 index = (u32)(tick >> (NEAR_BITS + LEVEL_BITS * level)) & (LEVEL_SLOTS - 1);
+                    cascade(NEAR_SLOTS + LEVEL_SLOTS * level + index);
+                    if (index != 0)
+                    {
+                        break;
+                    }
+                }
+            }
+
+            u32 slot = (u32)(tick & (NEAR_SLOTS - 1));
+            while (slots_[slot] != INVALID_ID)
+            {
+                u32 id = slots_[slot];
+                node* n = (node*)nodes_.at(id);
+                unlink(id, n);
+                u64 timer_id = ((u64)n->seq_ << 32) | id;
+                u32 callback_id = n->callback_id_;
+                u64 userdata = n->userdata_;
+                s64 expire_ms = n->expire_ms_;
+                nodes_.back(n);
+                fn(timer_id, callback_id, userdata, expire_ms);
+                fired++;
+            }
+            cur_ms_++;
+        }
+        return fired;
+    }
+
+private:
+    inline u32 slot_of(s64 expire_ms) const
+    {
+        u64 tick = expire_ms < cur_ms_ ? (u64)cur_ms_ : (u64)expire_ms;
+        u64 delay = tick - (u64)cur_ms_;
+        if (delay > MAX_DELAY)
+        {
+            delay = MAX_DELAY;
+            tick = (u64)cur_ms_ + delay;
+        }
+        if (delay < NEAR_SLOTS)
+        {
+            return (u32)(tick & (NEAR_SLOTS - 1));
+        }
+        for (u32 level = 0; level < LEVELS; level++)
+        {
+            u32 shift = NEAR_BITS + LEVEL_BITS * level;
+            if (delay < (1ULL << (shift + LEVEL_BITS)) || level + 1 == LEVELS)
+            {
+                return NEAR_SLOTS + LEVEL_SLOTS * level + ((u32)(tick >> shift) & (LEVEL_SLOTS - 1));
+            }
+        }
+        return 0;
+    }
+
+    inline void link(u32 id, node* n)
+    {
+        u32 slot = slot_of(n->expire_ms_);
+        n->slot_ = slot;
+        n->prev_ = INVALID_ID;
+        n->next_ = slots_[slot];
+        if (n->next_ != INVALID_ID)
+        {
+            ((node*)nodes_.at(n->next_))->prev_ = id;
+        }
+        slots_[slot] = id;
+    }
+
+    inline void unlink(u32 id, node* n)
+    {
+        if (n->prev_ != INVALID_ID)
+        {
+            ((node*)nodes_.at(n->prev_))->next_ = n->next_;
+        }
+        else
+        {
+            slots_[n->slot_] = n->next_;
+        }
+        if (n->next_ != INVALID_ID)
+        {
+            ((node*)nodes_.at(n->next_))->prev_ = n->prev_;
+        }
+    }
+
+    //move timers of a level slot down to lower slots.
+    inline void cascade(u32 slot)
+    {
+        u32 id = slots_[slot];
+        slots_[slot] = INVALID_ID;
+        while (id != INVALID_ID)
+        {
+            node* n = (node*)nodes_.at(id);
+            u32 next_id = n->next_;
+            link(id, n);
+            id = next_id;
+        }
+    }
+
+private:
+    s64 cur_ms_; //next ms to expire
+    u32 seq_;
+    u32 slots_[SLOTS];
+    zmem_pool nodes_;
+};
+
+
+
+#endif